@@ -0,0 +1,299 @@
+#include "heap.h"
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+
+// throughput of heap_malloc/heap_free/heap_realloc under the usual allocator workloads
+// usage: bench_heap [-w workload] [-t max_threads] [-n ops_per_thread] [-f]
+//   -w  churn, larson, prodcons, threadtest, fragmentation or all (default)
+//   -t  runs with 1, 2, 4, ... up to this many threads (default 4)
+//   -n  operations done by every thread (default 200000)
+//   -f  turns thread caches, slabs and remote frees on
+
+#define BENCH_SLOTS 1024                // live objects per thread
+#define BENCH_MAX_THREADS 16
+#define BENCH_RING 256                  // objects in flight between a producer and its consumer
+#define BENCH_THREADTEST_BATCH 4096     // objects allocated at once per thread in threadtest
+
+struct bench_thread{
+    int id;
+    int threads;
+    unsigned long ops;
+    unsigned int seed;
+};
+
+struct bench_workload{
+    const char* name;
+    void* (*run)(void*);
+    int min_threads;                    // prodcons needs pairs
+};
+
+unsigned long bench_ops = 200000;
+int bench_fast = 0;
+
+void* volatile larson_exchange[BENCH_MAX_THREADS];     // slot arrays handed over between larson threads
+
+struct bench_ring{
+    void* slots[BENCH_RING];
+    unsigned long head;                 // written by the producer only
+    unsigned long tail;                 // written by the consumer only
+} rings[BENCH_MAX_THREADS / 2];
+
+size_t bench_size(unsigned int* seed, size_t min, size_t max)
+{
+    return min + (size_t)rand_r(seed) % (max - min + 1);
+}
+
+void bench_touch(void* ptr, size_t size)     // the allocator has to hand out memory that is really used
+{
+    if(ptr)
+    {
+        ((volatile uint8_t*)ptr)[0] = 1;
+        ((volatile uint8_t*)ptr)[size - 1] = 1;
+    }
+}
+
+void* bench_churn(void* arg)     // random malloc/free over a fixed set of slots, sizes typical for small objects
+{
+    struct bench_thread* thread = arg;
+    void* slots[BENCH_SLOTS] = {0};
+    for(unsigned long i = 0; i < thread->ops; ++i)
+    {
+        int slot = rand_r(&thread->seed) % BENCH_SLOTS;
+        if(slots[slot])
+        {
+            heap_free(slots[slot]);
+            slots[slot] = NULL;
+        }
+        else
+        {
+            size_t size = bench_size(&thread->seed, 8, 256);
+            slots[slot] = heap_malloc(size);
+            bench_touch(slots[slot], size);
+        }
+    }
+    for(int slot = 0; slot < BENCH_SLOTS; ++slot)
+        heap_free(slots[slot]);
+    return NULL;
+}
+
+void* bench_larson(void* arg)     // server churn, every round the slots go to the next thread, which frees what others allocated
+{
+    struct bench_thread* thread = arg;
+    void** slots = calloc(BENCH_SLOTS, sizeof(void*));
+    unsigned long rounds = thread->ops / BENCH_SLOTS;
+    for(unsigned long round = 0; round < rounds; ++round)
+    {
+        for(int i = 0; i < BENCH_SLOTS; ++i)
+        {
+            int slot = rand_r(&thread->seed) % BENCH_SLOTS;
+            heap_free(slots[slot]);
+            size_t size = bench_size(&thread->seed, 8, 512);
+            slots[slot] = heap_malloc(size);
+            bench_touch(slots[slot], size);
+        }
+        // leave the slots for the next thread, then take what the previous one left here
+        void** pending = __atomic_exchange_n(&larson_exchange[(thread->id + 1) % thread->threads], slots, __ATOMIC_ACQ_REL);
+        slots = __atomic_exchange_n(&larson_exchange[thread->id], NULL, __ATOMIC_ACQ_REL);
+        if(!slots)     // the previous thread has not handed its slots over yet, go on with the ones the next thread did not take
+            slots = pending ? pending : calloc(BENCH_SLOTS, sizeof(void*));
+        else if(pending)
+        {
+            for(int slot = 0; slot < BENCH_SLOTS; ++slot)
+                heap_free(pending[slot]);
+            free(pending);
+        }
+    }
+    for(int slot = 0; slot < BENCH_SLOTS; ++slot)
+        heap_free(slots[slot]);
+    free(slots);
+    return NULL;
+}
+
+void* bench_producer(struct bench_thread* thread, struct bench_ring* ring)
+{
+    for(unsigned long i = 0; i < thread->ops; ++i)
+    {
+        size_t size = bench_size(&thread->seed, 16, 1024);
+        void* ptr = heap_malloc(size);
+        bench_touch(ptr, size);
+        while(__atomic_load_n(&ring->head, __ATOMIC_RELAXED) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == BENCH_RING)
+            sched_yield();     // the consumer may need this very core
+        ring->slots[ring->head % BENCH_RING] = ptr;
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+void* bench_consumer(struct bench_thread* thread, struct bench_ring* ring)
+{
+    for(unsigned long i = 0; i < thread->ops; ++i)
+    {
+        while(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == __atomic_load_n(&ring->tail, __ATOMIC_RELAXED))
+            sched_yield();
+        heap_free(ring->slots[ring->tail % BENCH_RING]);
+        __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+void* bench_prodcons(void* arg)     // even threads allocate, odd ones free what their neighbour allocated
+{
+    struct bench_thread* thread = arg;
+    struct bench_ring* ring = &rings[thread->id / 2];
+    return thread->id % 2 ? bench_consumer(thread, ring) : bench_producer(thread, ring);
+}
+
+void* bench_threadtest(void* arg)     // allocate a batch, free all of it, again
+{
+    struct bench_thread* thread = arg;
+    void** batch = malloc(BENCH_THREADTEST_BATCH * sizeof(void*));
+    for(unsigned long done = 0; done < thread->ops; done += 2 * BENCH_THREADTEST_BATCH)
+    {
+        for(int i = 0; i < BENCH_THREADTEST_BATCH; ++i)
+        {
+            batch[i] = heap_malloc(64);
+            bench_touch(batch[i], 64);
+        }
+        for(int i = 0; i < BENCH_THREADTEST_BATCH; ++i)
+            heap_free(batch[i]);
+    }
+    free(batch);
+    return NULL;
+}
+
+void* bench_fragmentation(void* arg)     // sizes over three orders of magnitude, resized in place and moved, some live long
+{
+    struct bench_thread* thread = arg;
+    void* slots[BENCH_SLOTS / 4] = {0};
+    size_t sizes[BENCH_SLOTS / 4] = {0};
+    for(unsigned long i = 0; i < thread->ops; ++i)
+    {
+        int slot = rand_r(&thread->seed) % (BENCH_SLOTS / 4);
+        size_t size = rand_r(&thread->seed) % 8 ? bench_size(&thread->seed, 16, 2048) : bench_size(&thread->seed, 2048, 16384);
+        int op = rand_r(&thread->seed) % 4;
+        if(!slots[slot])
+        {
+            slots[slot] = heap_malloc(size);
+            sizes[slot] = slots[slot] ? size : 0;
+        }
+        else if(op == 0)
+        {
+            void* ptr = heap_realloc(slots[slot], size);
+            if(ptr)
+            {
+                slots[slot] = ptr;
+                sizes[slot] = size;
+            }
+        }
+        else if(op == 1 || slot % 8)     // every eighth slot keeps its object until it gets resized
+        {
+            heap_free(slots[slot]);
+            slots[slot] = NULL;
+            sizes[slot] = 0;
+        }
+        bench_touch(slots[slot], sizes[slot]);
+    }
+    for(int slot = 0; slot < BENCH_SLOTS / 4; ++slot)
+        heap_free(slots[slot]);
+    return NULL;
+}
+
+struct bench_workload workloads[] = {
+    {"churn", bench_churn, 1},
+    {"larson", bench_larson, 1},
+    {"prodcons", bench_prodcons, 2},
+    {"threadtest", bench_threadtest, 1},
+    {"fragmentation", bench_fragmentation, 1},
+};
+
+int bench_run(const struct bench_workload* workload, int threads)
+{
+    struct heap_config config;
+    heap_get_default_config(&config);
+    config.validation = validation_off;     // the allocator is measured, not heap_validate
+    config.arenas = threads < ARENAS_MAX ? threads : ARENAS_MAX;
+    config.thread_cache = bench_fast;
+    config.slabs = bench_fast;
+    config.remote_frees = bench_fast;
+    if(heap_setup_ex(&config))
+    {
+        printf("%s: heap_setup_ex failed\n", workload->name);
+        return -1;
+    }
+    memset((void*)larson_exchange, 0, sizeof(larson_exchange));
+    memset(rings, 0, sizeof(rings));
+
+    pthread_t handles[BENCH_MAX_THREADS];
+    struct bench_thread args[BENCH_MAX_THREADS];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i = 0; i < threads; ++i)
+    {
+        args[i] = (struct bench_thread){i, threads, bench_ops, 12345u + (unsigned int)i};
+        pthread_create(&handles[i], NULL, workload->run, &args[i]);
+    }
+    for(int i = 0; i < threads; ++i)
+        pthread_join(handles[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for(int i = 0; i < threads; ++i)     // larson slot arrays still parked in the exchange
+    {
+        void** slots = larson_exchange[i];
+        for(int slot = 0; slots && slot < BENCH_SLOTS; ++slot)
+            heap_free(slots[slot]);
+        free(slots);
+    }
+    heap_thread_cache_flush();
+
+    struct heap_stats stats;
+    heap_get_stats(&stats);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-14s %7d %14.0f %10lu %14zu %10lu %8d\n", workload->name, threads, (double)bench_ops * threads / seconds,
+        stats.sbrk_calls, stats.peak_footprint, stats.lock_contentions, heap_validate());
+    heap_clean();
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* name = "all";
+    int max_threads = 4;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(!strcmp(argv[i], "-w") && i + 1 < argc)
+            name = argv[++i];
+        else if(!strcmp(argv[i], "-t") && i + 1 < argc)
+            max_threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-n") && i + 1 < argc)
+            bench_ops = strtoul(argv[++i], NULL, 10);
+        else if(!strcmp(argv[i], "-f"))
+            bench_fast = 1;
+        else
+        {
+            printf("usage: %s [-w churn|larson|prodcons|threadtest|fragmentation|all] [-t max_threads] [-n ops_per_thread] [-f]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(max_threads < 1 || max_threads > BENCH_MAX_THREADS)
+        max_threads = max_threads < 1 ? 1 : BENCH_MAX_THREADS;
+
+    printf("%-14s %7s %14s %10s %14s %10s %8s\n", "workload", "threads", "ops/s", "sbrk", "peak bytes", "contended", "validate");
+    int found = 0;
+    for(size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w)
+    {
+        if(strcmp(name, "all") && strcmp(name, workloads[w].name))
+            continue;
+        found = 1;
+        for(int threads = workloads[w].min_threads; threads <= max_threads; threads *= 2)
+        {
+            if(bench_run(&workloads[w], threads))
+                return 1;
+        }
+    }
+    if(!found)
+    {
+        printf("unknown workload %s\n", name);
+        return 1;
+    }
+    return 0;
+}
@@ -1,1330 +1,2206 @@
-#include "heap.h"
-
-void* heap_start = NULL;
-mem_header* first_block = NULL;
-uint8_t heap_is_empty = 1;
-unsigned long pages_allocated = 0;
-unsigned long header_size = sizeof(mem_header);
-pthread_mutex_t mutex;
-
-
-void draw_fences(mem_header* address)
-{
-    for(int i = 0; i < FENCE_SIZE; ++i)
-        *(char*)((uint8_t*)address + header_size + i) = 'f';
-    for(int i = 0; i < FENCE_SIZE; ++i)
-        *(char*)((uint8_t*)address + header_size + FENCE_SIZE + address->size + i) = 'F';
-}
-
-size_t calculate_control_size(uint8_t* ptr)
-{
-    size_t control_sum = 0;
-    for(size_t i = 0; i < CONTROL_SIZE; ++i)
-        control_sum += *(ptr + i);
-    return control_sum;
-}
-
-void header_setup(mem_header* header, unsigned long size, mem_header* prev, mem_header* next)
-{
-    header->size = size;
-    header->free = 0;
-    header->next = next;
-    header->prev = prev;
-    header->control_sum = calculate_control_size((uint8_t*)header);
-
-    draw_fences(header);
-
-    if(prev)
-    {
-        prev->next = header;
-        prev->control_sum = calculate_control_size((uint8_t*)prev);
-    }
-    if(next)
-    {
-        next->prev = header;
-        next->control_sum = calculate_control_size((uint8_t*)next);
-    }
-}
-
-void header_setup_debug(mem_header* header, unsigned long size, mem_header* prev, mem_header* next, int fileline, const char* filename)
-{
-    header->size = size;
-    header->free = 0;
-    header->next = next;
-    header->prev = prev;
-    header->fileline = fileline;
-    header->filename = filename;
-    header->control_sum = calculate_control_size((uint8_t*)header);
-
-    draw_fences(header);
-
-    if(prev)
-    {
-        prev->next = header;
-        prev->control_sum = calculate_control_size((uint8_t*)prev);
-    }
-    if(next)
-    {
-        next->prev = header;
-        next->control_sum = calculate_control_size((uint8_t*)next);
-    }
-}
-
-int heap_setup(void)
-{
-    heap_start = custom_sbrk(PAGE_SIZE);
-    if(heap_start == (void*)-1)
-        return -1;
-    pages_allocated = 1;
-    pthread_mutex_init(&mutex, NULL);
-
-    return 0;
-}
-
-void heap_clean(void)
-{
-    if(heap_start == NULL)
-        return;
-    unsigned long memory_used = pages_allocated * PAGE_SIZE;
-    custom_sbrk((-1) * memory_used);
-    heap_start = NULL;
-    first_block = NULL;
-    heap_is_empty = 1;
-    pthread_mutex_destroy(&mutex);
-}
-
-void* heap_malloc(size_t size)
-{
-    if(!size || heap_validate() || !heap_start)
-    {
-        return NULL;
-    }
-    pthread_mutex_lock(&mutex);
-
-    if(heap_start && heap_is_empty == 1)  //empty heap
-    {
-        size_t offset = ALIGN((size_t)((uint8_t*)heap_start + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)heap_start + header_size + FENCE_SIZE);
-        heap_is_empty = 0;
-        while(pages_allocated * PAGE_SIZE < size + offset)
-        {
-            void* temp = custom_sbrk(PAGE_SIZE);
-            if(temp == (void*)-1)
-            {
-                pthread_mutex_unlock(&mutex);
-                return NULL;
-            }
-            else
-                ++pages_allocated;
-        }
-
-        first_block = (mem_header*)((uint8_t*)heap_start + offset);
-        mem_header* first_block_allocated = first_block;
-        header_setup(first_block_allocated, size, NULL, NULL);
-        pthread_mutex_unlock(&mutex);
-        return (void*)((uint8_t*)first_block_allocated + FENCE_SIZE + header_size);
-    }
-
-    mem_header* temp = first_block;
-    while(temp)     // look for free blocks with enough size and right address
-    {
-        size_t offset = ALIGN((size_t)((uint8_t*)temp + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + header_size + FENCE_SIZE);
-        if(temp->free && temp->size >= size + offset)
-        {
-            size_t offset_new_block = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset + header_size + FENCE_SIZE);
-            if(temp->next && (uintptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset + offset_new_block + HEADER_FENCE_SIZE(1)) < (uintptr_t)temp->next)
-            {
-                mem_header* new_block = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset + offset_new_block);
-                header_setup(new_block, (uint8_t*)temp->next - ((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset + offset_new_block) - header_size - 2 * FENCE_SIZE, temp, temp->next);
-                new_block->free = 1;
-                new_block->control_sum = calculate_control_size((uint8_t*)new_block);
-                header_setup(temp, size, temp->prev, new_block);
-            }
-            else
-                header_setup(temp, size, temp->prev, temp->next);
-            pthread_mutex_unlock(&mutex);
-            return (void*)((uint8_t*)temp + header_size + FENCE_SIZE);
-        }
-        if(temp->next)
-            temp = temp->next;
-        else        //if not present, see how much memory is free, and if not sufficient, request OS for more. check the result and then create new header
-        {
-            unsigned long free_memory_on_heap = pages_allocated * PAGE_SIZE - (((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size)) - (uint8_t*)heap_start);
-
-            while(free_memory_on_heap < HEADER_FENCE_SIZE(size))
-            {
-                void* res = custom_sbrk(PAGE_SIZE);
-                if(res == (void*)-1)
-                {
-                    pthread_mutex_unlock(&mutex);
-                    return NULL;
-                }
-                else
-                {
-                    free_memory_on_heap += PAGE_SIZE;
-                    ++pages_allocated;
-                }
-            }
-            if(IS_POINTER_DIVISIBLE_BY_WORD((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE))
-            {
-                temp->next = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size));
-                header_setup(temp->next, size, temp, NULL);
-
-                if(temp->free)
-                {
-                    header_setup(temp, temp->size, temp->prev, temp->next);
-                    temp->free = 1;
-                    temp->control_sum = calculate_control_size((uint8_t*)temp);
-                }
-                else
-                    header_setup(temp, temp->size, temp->prev, temp->next);
-
-                pthread_mutex_unlock(&mutex);
-                return (void*)((uint8_t*)temp->next + header_size + FENCE_SIZE);
-            }
-            else
-            {
-                offset = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE);
-
-                while(free_memory_on_heap < HEADER_FENCE_SIZE(size) + offset)
-                {
-                    void* res = custom_sbrk(PAGE_SIZE);
-                    if(res == (void*)-1)
-                    {
-                        pthread_mutex_unlock(&mutex);
-                        return NULL;
-                    }
-                    else
-                    {
-                        free_memory_on_heap += PAGE_SIZE;
-                        ++pages_allocated;
-                    }
-                }
-                if(temp->free)
-                {
-                    header_setup(temp, temp->size, temp->prev, temp->next);
-                    temp->free = 1;
-                    temp->control_sum = calculate_control_size((uint8_t*)temp);
-                }
-                else
-                    header_setup(temp, temp->size, temp->prev, temp->next);
-
-                temp->next = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + offset);
-                header_setup(temp->next, size, temp, NULL);
-
-                pthread_mutex_unlock(&mutex);
-                return (void*)((uint8_t*)temp->next + FENCE_SIZE + header_size);
-            }
-        }
-    }
-
-    pthread_mutex_unlock(&mutex);
-    return NULL;
-}
-
-void* heap_calloc(size_t number, size_t size)
-{
-    if(!number || !size || heap_validate())
-    {
-        return NULL;
-    }
-
-    void* ptr = heap_malloc(number * size);
-    pthread_mutex_lock(&mutex);
-    if(ptr)
-    {
-        memset(ptr, 0, number * size);
-        pthread_mutex_unlock(&mutex);
-        return ptr;
-    }
-
-    pthread_mutex_unlock(&mutex);
-    return NULL;
-}
-
-void* heap_realloc(void* memblock, size_t size)
-{
-    if((!memblock && !size) || heap_validate())
-    {
-        return NULL;
-    }
-    if(size == 0)
-    {
-        heap_free(memblock);
-        return NULL;
-    }
-    if(!memblock)
-    {
-        return heap_malloc(size);
-    }
-
-    if(get_pointer_type(memblock) != pointer_valid)
-    {
-        return NULL;
-    }
-
-    pthread_mutex_lock(&mutex);
-
-    mem_header* temp = (mem_header*)((uint8_t*)memblock - FENCE_SIZE - header_size);
-    if(temp->size == size)    // new size == old size, nothing changes
-    {
-        pthread_mutex_unlock(&mutex);
-        return memblock;
-    }
-
-    if(temp->size > size)     // new size < old size, shrink the block and update control sum
-    {
-        size_t offset_new_block = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + header_size + FENCE_SIZE);
-        if(temp->next && (uintptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + HEADER_FENCE_SIZE(1) + offset_new_block) < (uintptr_t)temp->next)
-        {
-            mem_header* new_block = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset_new_block);
-            header_setup(new_block, (uint8_t*)temp->next - ((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset_new_block) - header_size - 2 * FENCE_SIZE, temp, temp->next);
-            new_block->free = 1;
-            new_block->control_sum = calculate_control_size((uint8_t*)new_block);
-            header_setup(temp, size, temp->prev, new_block);
-        }
-        else
-            header_setup(temp, size, temp->prev, temp->next);
-
-        pthread_mutex_unlock(&mutex);
-        return memblock;
-    }
-    else
-    {
-        if(temp->next)         //check whether next block exists
-        {
-            // if so, check if its' size + size of curr block is enough to fit the new block
-            if(temp->next->free && (unsigned long)(((uint8_t*)temp->next + HEADER_FENCE_SIZE(temp->next->size) - (uint8_t*)temp)) >= HEADER_FENCE_SIZE(size))
-            {
-                header_setup(temp, size, temp->prev, temp->next->next);
-                pthread_mutex_unlock(&mutex);
-                return memblock;
-            }
-            else if((unsigned long)(((uint8_t*)temp->next - (uint8_t*)temp)) >= HEADER_FENCE_SIZE(size))
-            {
-                header_setup(temp, size, temp->prev, temp->next);
-                pthread_mutex_unlock(&mutex);
-                return memblock;
-            }
-            else                   // if not, there is a need to change the block's location
-            {
-                pthread_mutex_unlock(&mutex);
-                void *new_block_location = heap_malloc(size);
-                pthread_mutex_lock(&mutex);
-                if(!new_block_location)
-                {
-                    pthread_mutex_unlock(&mutex);
-                    return NULL;
-                }
-
-                memcpy(new_block_location, memblock, temp->size);
-                pthread_mutex_unlock(&mutex);
-                heap_free((uint8_t*)temp + header_size + FENCE_SIZE);
-                pthread_mutex_lock(&mutex);
-                ((mem_header*)((uint8_t*)new_block_location - header_size - FENCE_SIZE))->control_sum = calculate_control_size((uint8_t*)new_block_location - header_size - FENCE_SIZE);
-                pthread_mutex_unlock(&mutex);
-                return new_block_location;
-            }
-        }
-        else
-        {
-            unsigned long free_memory_on_heap = pages_allocated * PAGE_SIZE - (((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size)) - (uint8_t*)heap_start);
-
-            while(free_memory_on_heap < HEADER_FENCE_SIZE(size))
-            {
-                void* res = custom_sbrk(PAGE_SIZE);
-                if(res == (void*)-1)
-                {
-                    pthread_mutex_unlock(&mutex);
-                    return NULL;
-                }
-                else
-                {
-                    free_memory_on_heap += PAGE_SIZE;
-                    ++pages_allocated;
-                }
-            }
-            header_setup(temp, size, temp->prev, NULL);
-            pthread_mutex_unlock(&mutex);
-            return memblock;
-        }
-    }
-}
-
-mem_header* concat_memory_blocks(mem_header* p1, mem_header* p2)
-{
-    p1->next = p2->next;
-    if(p2->next)
-        p2->next->prev = p1;
-    p1->size = p1->size + p2->size + header_size;
-    return p1;
-}
-
-
-void heap_free(void* memblock)
-{
-    if(!memblock || get_pointer_type(memblock) != pointer_valid)
-    {
-        return;
-    }
-    pthread_mutex_lock(&mutex);
-
-    mem_header* header = (mem_header*)((uint8_t*)memblock - FENCE_SIZE - header_size);
-    header->free = 1;
-
-    if(header->prev && header->prev->free)
-        header = concat_memory_blocks(header->prev, header);
-    if(header->next && header->next->free)
-        header = concat_memory_blocks(header, header->next);
-    if(header->next)
-        header->size = (uint8_t*)header->next - (uint8_t*)header - HEADER_FENCE_SIZE(0);
-
-    draw_fences((void*)header);
-    if(header->prev)
-        header->prev->control_sum = calculate_control_size((uint8_t*)header->prev);
-    header->control_sum = calculate_control_size((uint8_t*)header);
-    if(header->next)
-        header->next->control_sum = calculate_control_size((uint8_t*)header->next);
-
-    pthread_mutex_unlock(&mutex);
-}
-
-size_t heap_get_largest_used_block_size(void)
-{
-    if(!heap_start || heap_is_empty || heap_validate())
-        return 0;
-
-    size_t max_size = 0;
-    mem_header* temp = first_block;
-
-    while(temp)
-    {
-        if(temp->free == 0)
-        {
-            if(max_size < temp->size)
-                max_size = temp->size;
-        }
-        temp = temp->next;
-    }
-
-    return max_size;
-}
-
-enum pointer_type_t get_pointer_type(const void* const pointer)
-{
-    if(!pointer)
-        return pointer_null;
-    if(heap_validate())
-        return pointer_heap_corrupted;
-
-    intptr_t ptr_handle = (intptr_t)pointer;
-    if(ptr_handle < (intptr_t)heap_start)
-        return pointer_unallocated;
-    else if(ptr_handle < (intptr_t)((uint8_t*)first_block + header_size))
-        return pointer_control_block;
-
-    mem_header* temp = first_block;
-
-    while(temp->next && (intptr_t)temp->next <= ptr_handle)
-        temp = temp->next;
-    if(ptr_handle < (intptr_t)((uint8_t*)temp + header_size))
-        return pointer_control_block;
-    else if(ptr_handle < (intptr_t)((uint8_t*)temp + header_size + FENCE_SIZE) && temp->free == 0)
-        return pointer_inside_fences;
-    else if(ptr_handle < (intptr_t)((uint8_t*)temp + header_size + FENCE_SIZE) && temp->free == 1)
-        return pointer_unallocated;
-    else if(ptr_handle == (intptr_t)((uint8_t*)temp + header_size + FENCE_SIZE) && temp->free == 0)
-        return pointer_valid;
-    else if(ptr_handle == (intptr_t)((uint8_t*)temp + header_size + FENCE_SIZE))
-        return pointer_unallocated;
-    else if(ptr_handle < (intptr_t)((uint8_t*)temp + header_size + FENCE_SIZE + temp->size) && temp->free == 0)
-        return pointer_inside_data_block;
-    else if(ptr_handle < (intptr_t)((uint8_t*)temp + header_size + FENCE_SIZE + temp->size))
-        return pointer_unallocated;
-    else if(ptr_handle < (intptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size)) && temp->free == 0)
-        return pointer_inside_fences;
-    else if(ptr_handle >= (intptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) - FENCE_SIZE) && temp->free == 0 && ptr_handle < (intptr_t)temp->next)
-        return pointer_inside_fences;
-
-    return pointer_unallocated;
-}
-
-int heap_validate(void)
-{
-    // check if heap initialized
-    if(heap_start == NULL)
-    {
-        return 2;              // return value 2 == HEAP_UNINITIALIZED
-    }
-    ///////////////////////////
-    if(heap_is_empty)
-    {
-        return 0;              // return value 0 == HEAP_OK
-    }
-    pthread_mutex_lock(&mutex);
-    mem_header* i = first_block;
-    while(i)
-    {
-        // check control sum //
-        size_t temp_ctr_sum = calculate_control_size((uint8_t*)i);
-
-        if(temp_ctr_sum != i->control_sum)
-        {
-            pthread_mutex_unlock(&mutex);
-            return 3;          // return value 3 == HEAP_CONTROL_STRUCTURES_CORRUPTED
-        }
-
-        //////////////////////
-        // check fences integrity //
-        for(int j = 0; j < FENCE_SIZE; ++j)
-        {
-            if(*(char*)((uint8_t*)i + header_size + j) != 'f')
-            {
-                pthread_mutex_unlock(&mutex);
-                return 1;      // return value 1 == FENCES_CORRUPTED
-            }
-        }
-        for(int j = 0; j < FENCE_SIZE; ++j)
-        {
-            if(*(char*)((uint8_t*)i + header_size + FENCE_SIZE + i->size + j) != 'F')
-            {
-                pthread_mutex_unlock(&mutex);
-                return 1;      // return value 1 == FENCES_CORRUPTED
-            }
-        }
-        ////////////////////////////
-        i = i->next;
-    }
-
-    pthread_mutex_unlock(&mutex);
-    return 0;       // return value 0 == HEAP_OK
-}
-
-void* heap_malloc_aligned(size_t size)
-{
-    if(!size || heap_validate() || !heap_start)
-    {
-        return NULL;
-    }
-    pthread_mutex_lock(&mutex);
-
-    if(heap_start && heap_is_empty == 1)  //empty heap
-    {
-        size_t offset_page = ALIGN((size_t)((uint8_t*)heap_start + header_size + FENCE_SIZE), PAGE_SIZE) - (size_t)((uint8_t*)heap_start + header_size + FENCE_SIZE);
-        size_t offset_word = ALIGN((size_t)((uint8_t*)heap_start + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)heap_start + header_size + FENCE_SIZE);
-        heap_is_empty = 0;
-        while(pages_allocated * PAGE_SIZE < HEADER_FENCE_SIZE(size) + offset_page)
-        {
-            void* temp = custom_sbrk(PAGE_SIZE);
-            if(temp == (void*)-1)
-            {
-                pthread_mutex_unlock(&mutex);
-                return NULL;
-            }
-            else
-                ++pages_allocated;
-        }
-
-        first_block = (mem_header*)((uint8_t*)heap_start + offset_word);
-        mem_header* first_block_allocated = first_block;     //first block will be free, it fits in the offset area of the block aligned for page size
-        mem_header* second_block = (mem_header*)((uint8_t*)heap_start + offset_page);  //the second is aligned to the page and with size given by user
-
-        header_setup(first_block_allocated, offset_page - offset_word - header_size - 2 * FENCE_SIZE, NULL, second_block);
-        first_block_allocated->free = 1;
-        first_block_allocated->control_sum = calculate_control_size((uint8_t*)first_block_allocated);
-        header_setup(second_block, size, first_block, NULL);
-
-        pthread_mutex_unlock(&mutex);
-        return (void*)((uint8_t*)second_block + FENCE_SIZE + header_size);
-    }
-
-    mem_header* temp = first_block;
-    while(temp)     // look for free blocks with enough size and right address
-    {
-        size_t offset = ALIGN((size_t)((uint8_t*)temp + header_size + FENCE_SIZE), PAGE_SIZE) - (size_t)((uint8_t*)temp + header_size + FENCE_SIZE);
-        if(temp->free && temp->size >= HEADER_FENCE_SIZE(size) + offset)
-        {
-            if(offset == 0)
-            {
-                size_t offset_new_block = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + header_size + FENCE_SIZE);
-                if(temp->next && (uintptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset_new_block + HEADER_FENCE_SIZE(1)) < (uintptr_t)temp->next)
-                {
-                    mem_header* new_block = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset_new_block);
-                    header_setup(new_block, (uint8_t*)temp->next - ((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset_new_block) - header_size - 2 * FENCE_SIZE, temp, temp->next);
-                    new_block->free = 1;
-                    new_block->control_sum = calculate_control_size((uint8_t*)new_block);
-                    temp->next->prev = new_block;
-                    temp->next->control_sum = calculate_control_size((uint8_t*)temp->next);
-                    header_setup(temp, size, temp->prev, new_block);
-                }
-                else
-                    header_setup(temp, size, temp->prev, temp->next);
-                pthread_mutex_unlock(&mutex);
-                return (void*)((uint8_t*)temp + header_size + FENCE_SIZE);
-            }
-            else
-            {
-                if(offset > HEADER_FENCE_SIZE(1))
-                {
-                    mem_header* new_block = (mem_header*)((uint8_t*)temp + offset);
-                    header_setup(new_block, temp->size - offset - HEADER_FENCE_SIZE(0), temp, temp->next);
-                    new_block->free = 1;
-                    new_block->control_sum = calculate_control_size((uint8_t*)new_block);
-                    temp->next->prev = new_block;
-                    temp->next->control_sum = calculate_control_size((uint8_t*)temp->next);
-                    header_setup(temp, offset - header_size - 2 * FENCE_SIZE, temp->prev, new_block);
-                    temp->free = 1;
-                    temp->control_sum = calculate_control_size((uint8_t*)temp);
-
-                    temp = temp->next;
-                    continue;
-                }
-                else
-                {
-                    temp = temp->next;
-                    continue;
-                }
-            }
-        }
-        if(temp->next)
-            temp = temp->next;
-        else        //if not present, see how much memory is free, and if not sufficient, request OS for more. check the result and then create new header
-        {
-            unsigned long free_memory_on_heap = pages_allocated * PAGE_SIZE - (((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size)) - (uint8_t*)heap_start);
-
-            while(free_memory_on_heap < HEADER_FENCE_SIZE(size))
-            {
-                void* res = custom_sbrk(PAGE_SIZE);
-                if(res == (void*)-1)
-                {
-                    pthread_mutex_unlock(&mutex);
-                    return NULL;
-                }
-                else
-                {
-                    free_memory_on_heap += PAGE_SIZE;
-                    ++pages_allocated;
-                }
-            }
-            if(IS_POINTER_DIVISIBLE_BY_4096((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE))
-            {
-                temp->next = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size));
-                header_setup(temp->next, size, temp, NULL);
-                header_setup(temp, temp->size, temp->prev, temp->next);
-                pthread_mutex_unlock(&mutex);
-                return (void*)((uint8_t*)temp->next + header_size + FENCE_SIZE);
-            }
-            else
-            {
-                offset = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE), PAGE_SIZE) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE);
-                while(free_memory_on_heap < HEADER_FENCE_SIZE(size) + offset)
-                {
-                    void* res = custom_sbrk(PAGE_SIZE);
-                    if(res == (void*)-1)
-                    {
-                        pthread_mutex_unlock(&mutex);
-                        return NULL;
-                    }
-                    else
-                    {
-                        free_memory_on_heap += PAGE_SIZE;
-                        ++pages_allocated;
-                    }
-                }
-                temp->next = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + offset);
-
-                size_t offset_new_block = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE);
-                if(offset > HEADER_FENCE_SIZE(1) + offset_new_block)
-                {
-                    mem_header* new_block_empty = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + offset_new_block);
-                    mem_header* new_block_allocated = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + offset);
-                    header_setup(new_block_empty, offset - offset_new_block - HEADER_FENCE_SIZE(0), temp, new_block_allocated);
-                    new_block_empty->free = 1;
-                    new_block_empty->control_sum = calculate_control_size((uint8_t*)new_block_empty);
-                    header_setup(new_block_allocated, size, new_block_empty, NULL);
-                    if(temp->free)
-                    {
-                        header_setup(temp, temp->size, temp->prev, new_block_empty);
-                        temp->free = 1;
-                        temp->control_sum = calculate_control_size((uint8_t*)temp);
-                    }
-                    else
-                        header_setup(temp, temp->size, temp->prev, new_block_empty);
-                    pthread_mutex_unlock(&mutex);
-                    return (void*)((uint8_t*)new_block_allocated + FENCE_SIZE + header_size);
-                }
-                header_setup(temp->next, size, temp, NULL);
-                if(temp->free)
-                {
-                    header_setup(temp, temp->size, temp->prev, temp->next);
-                    temp->free = 1;
-                    temp->control_sum = calculate_control_size((uint8_t*)temp);
-                }
-                else
-                    header_setup(temp, temp->size, temp->prev, temp->next);
-
-                pthread_mutex_unlock(&mutex);
-                return (void*)((uint8_t*)temp->next + FENCE_SIZE + header_size);
-            }
-        }
-    }
-
-    pthread_mutex_unlock(&mutex);
-    return NULL;
-}
-
-void* heap_calloc_aligned(size_t number, size_t size)
-{
-    if(!number || !size || heap_validate())
-    {
-        return NULL;
-    }
-
-    void* ptr = heap_malloc_aligned(number * size);
-    pthread_mutex_lock(&mutex);
-    if(ptr)
-    {
-        memset(ptr, 0, number * size);
-        pthread_mutex_unlock(&mutex);
-        return ptr;
-    }
-
-    pthread_mutex_unlock(&mutex);
-    return NULL;
-}
-
-void* heap_realloc_aligned(void* memblock, size_t size)
-{
-    if((!memblock && !size) || heap_validate())
-    {
-        return NULL;
-    }
-
-    if(size == 0)
-    {
-        heap_free(memblock);
-        return NULL;
-    }
-    if(!memblock)
-    {
-        return heap_malloc_aligned(size);
-    }
-    if(get_pointer_type(memblock) != pointer_valid)
-    {
-        return NULL;
-    }
-    pthread_mutex_lock(&mutex);
-
-    mem_header* temp = (mem_header*)((uint8_t*)memblock - FENCE_SIZE - header_size);
-    if(temp->size == size)    // new size == old size, nothing changes
-    {
-        pthread_mutex_unlock(&mutex);
-        return memblock;
-    }
-    if(temp->size > size)     // new size < old size, shrink the block and update control sum
-    {
-        if(temp->next && (uintptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + HEADER_FENCE_SIZE(1)) < (uintptr_t)temp->next)
-        {
-            mem_header* new_block = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(size));
-            header_setup(new_block, (uint8_t*)temp->next - ((uint8_t*)temp + HEADER_FENCE_SIZE(size)) - header_size - 2 * FENCE_SIZE, temp, temp->next);
-            new_block->free = 1;
-            new_block->control_sum = calculate_control_size((uint8_t*)new_block);
-            header_setup(temp, size, temp->prev, new_block);
-        }
-        else
-            header_setup(temp, size, temp->prev, temp->next);
-
-        pthread_mutex_unlock(&mutex);
-        return memblock;
-    }
-    else
-    {
-        if(temp->next)         //check whether next block exists
-        {
-            // if so, check if its' size + size of curr block is enough to fit the new block
-            if(temp->next->free && (unsigned long)(((uint8_t*)temp->next + HEADER_FENCE_SIZE(temp->next->size) - (uint8_t*)temp)) >= HEADER_FENCE_SIZE(size))
-            {
-                header_setup(temp, size, temp->prev, temp->next->next);
-                pthread_mutex_unlock(&mutex);
-                return memblock;
-            }
-            else if((unsigned long)(((uint8_t*)temp->next - (uint8_t*)temp)) >= HEADER_FENCE_SIZE(size))
-            {
-                header_setup(temp, size, temp->prev, temp->next);
-                pthread_mutex_unlock(&mutex);
-                return memblock;
-            }
-            else                   // if not, there is a need to change the block's location
-            {
-                pthread_mutex_unlock(&mutex);
-                void *new_block_location = heap_malloc_aligned(size);
-                pthread_mutex_lock(&mutex);
-                if(!new_block_location)
-                {
-                    pthread_mutex_unlock(&mutex);
-                    return NULL;
-                }
-
-                memcpy(new_block_location, memblock, temp->size);
-                pthread_mutex_unlock(&mutex);
-                heap_free((uint8_t*)temp + header_size + FENCE_SIZE);
-                pthread_mutex_lock(&mutex);
-                ((mem_header*)((uint8_t*)new_block_location - header_size - FENCE_SIZE))->control_sum = calculate_control_size((uint8_t*)new_block_location - header_size - FENCE_SIZE);
-                pthread_mutex_unlock(&mutex);
-                return new_block_location;
-            }
-        }
-        else
-        {
-            unsigned long free_memory_on_heap = pages_allocated * PAGE_SIZE - (((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size)) - (uint8_t*)heap_start);
-
-            while(free_memory_on_heap < HEADER_FENCE_SIZE(size))
-            {
-                void* res = custom_sbrk(PAGE_SIZE);
-                if(res == (void*)-1)
-                {
-                    pthread_mutex_unlock(&mutex);
-                    return NULL;
-                }
-                else
-                {
-                    free_memory_on_heap += PAGE_SIZE;
-                    ++pages_allocated;
-                }
-            }
-            header_setup(temp, size, temp->prev, NULL);
-            pthread_mutex_unlock(&mutex);
-            return memblock;
-        }
-    }
-}
-
-
-void* heap_malloc_debug(size_t size, int fileline, const char* filename)
-{
-    if(!size || heap_validate() || !heap_start)
-    {
-        return NULL;
-    }
-
-    pthread_mutex_lock(&mutex);
-    if(heap_start && heap_is_empty == 1)  //empty heap
-    {
-        size_t offset = ALIGN((size_t)((uint8_t*)heap_start + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)heap_start + header_size + FENCE_SIZE);
-        heap_is_empty = 0;
-        while(pages_allocated * PAGE_SIZE < size + offset)
-        {
-            void* temp = custom_sbrk(PAGE_SIZE);
-            if(temp == (void*)-1)
-            {
-                pthread_mutex_unlock(&mutex);
-                return NULL;
-            }
-            else
-                ++pages_allocated;
-        }
-
-        first_block = (mem_header*)((uint8_t*)heap_start + offset);
-        mem_header* first_block_allocated = first_block;
-        header_setup_debug(first_block_allocated, size, NULL, NULL, fileline, filename);
-        pthread_mutex_unlock(&mutex);
-        return (void*)((uint8_t*)first_block_allocated + FENCE_SIZE + header_size);
-    }
-
-    mem_header* temp = first_block;
-    while(temp)     // look for free blocks with enough size and right address
-    {
-        size_t offset = ALIGN((size_t)((uint8_t*)temp + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + header_size + FENCE_SIZE);
-        if(temp->free && temp->size >= size + offset)
-        {
-            size_t offset_new_block = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset + header_size + FENCE_SIZE);
-            if(temp->next && (uintptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset + offset_new_block + HEADER_FENCE_SIZE(1)) < (uintptr_t)temp->next)
-            {
-                mem_header* new_block = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset + offset_new_block);
-                header_setup_debug(new_block, (uint8_t*)temp->next - ((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset + offset_new_block) - header_size - 2 * FENCE_SIZE, temp, temp->next, fileline, filename);
-                new_block->free = 1;
-                new_block->control_sum = calculate_control_size((uint8_t*)new_block);
-                header_setup_debug(temp, size, temp->prev, new_block, fileline, filename);
-            }
-            else
-                header_setup_debug(temp, size, temp->prev, temp->next, fileline, filename);
-            pthread_mutex_unlock(&mutex);
-            return (void*)((uint8_t*)temp + header_size + FENCE_SIZE);
-        }
-        if(temp->next)
-            temp = temp->next;
-        else        //if not present, see how much memory is free, and if not sufficient, request OS for more. check the result and then create new header
-        {
-            unsigned long free_memory_on_heap = pages_allocated * PAGE_SIZE - (((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size)) - (uint8_t*)heap_start);
-
-            while(free_memory_on_heap < HEADER_FENCE_SIZE(size))
-            {
-                void* res = custom_sbrk(PAGE_SIZE);
-                if(res == (void*)-1)
-                {
-                    pthread_mutex_unlock(&mutex);
-                    return NULL;
-                }
-                else
-                {
-                    free_memory_on_heap += PAGE_SIZE;
-                    ++pages_allocated;
-                }
-            }
-            if(IS_POINTER_DIVISIBLE_BY_WORD((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE))
-            {
-                temp->next = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size));
-                header_setup_debug(temp->next, size, temp, NULL, fileline, filename);
-                pthread_mutex_unlock(&mutex);
-                return (void*)((uint8_t*)temp->next + header_size + FENCE_SIZE);
-            }
-            else
-            {
-                offset = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE);
-
-                while(free_memory_on_heap < HEADER_FENCE_SIZE(size) + offset)
-                {
-                    void* res = custom_sbrk(PAGE_SIZE);
-                    if(res == (void*)-1)
-                    {
-                        pthread_mutex_unlock(&mutex);
-                        return NULL;
-                    }
-                    else
-                    {
-                        free_memory_on_heap += PAGE_SIZE;
-                        ++pages_allocated;
-                    }
-                }
-                temp->next = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + offset);
-                header_setup_debug(temp->next, size, temp, NULL, fileline, filename);
-
-                pthread_mutex_unlock(&mutex);
-                return (void*)((uint8_t*)temp->next + FENCE_SIZE + header_size);
-            }
-        }
-    }
-    pthread_mutex_unlock(&mutex);
-    return NULL;
-}
-void* heap_calloc_debug(size_t number, size_t size, int fileline, const char* filename)
-{
-    if(!number || !size || heap_validate())
-    {
-        return NULL;
-    }
-
-    void* ptr = heap_malloc_debug(number * size, fileline, filename);
-    pthread_mutex_lock(&mutex);
-    if(ptr)
-    {
-        memset(ptr, 0, number * size);
-        pthread_mutex_unlock(&mutex);
-        return ptr;
-    }
-
-    pthread_mutex_unlock(&mutex);
-    return NULL;
-}
-void* heap_realloc_debug(void* memblock, size_t size, int fileline, const char* filename)
-{
-    if((!memblock && !size) || heap_validate())
-    {
-        return NULL;
-    }
-
-    if(size == 0)
-    {
-        heap_free(memblock);
-        return NULL;
-    }
-    if(!memblock)
-    {
-        return heap_malloc_debug(size, fileline, filename);
-    }
-    if(get_pointer_type(memblock) != pointer_valid)
-    {
-        return NULL;
-    }
-    pthread_mutex_lock(&mutex);
-    mem_header* temp = (mem_header*)((uint8_t*)memblock - FENCE_SIZE - header_size);
-    if(temp->size == size)    // new size == old size, nothing changes
-    {
-        pthread_mutex_unlock(&mutex);
-        return memblock;
-    }
-    if(temp->size > size)     // new size < old size, shrink the block and update control sum
-    {
-        size_t offset_new_block = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + header_size + FENCE_SIZE);
-        if(temp->next && (uintptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + HEADER_FENCE_SIZE(1) + offset_new_block) < (uintptr_t)temp->next)
-        {
-            mem_header* new_block = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset_new_block);
-            header_setup_debug(new_block, (uint8_t*)temp->next - ((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset_new_block) - header_size - 2 * FENCE_SIZE, temp, temp->next, fileline, filename);
-            new_block->free = 1;
-            new_block->control_sum = calculate_control_size((uint8_t*)new_block);
-            header_setup_debug(temp, size, temp->prev, new_block, fileline, filename);
-        }
-        else
-            header_setup_debug(temp, size, temp->prev, temp->next, fileline, filename);
-
-        pthread_mutex_unlock(&mutex);
-        return memblock;
-    }
-    else
-    {
-        if(temp->next)         //check whether next block exists
-        {
-            // if so, check if its' size + size of curr block is enough to fit the new block
-            if(temp->next->free && (unsigned long)(((uint8_t*)temp->next + HEADER_FENCE_SIZE(temp->next->size) - (uint8_t*)temp)) >= HEADER_FENCE_SIZE(size))
-            {
-                header_setup_debug(temp, size, temp->prev, temp->next->next, fileline, filename);
-                pthread_mutex_unlock(&mutex);
-                return memblock;
-            }
-            else if((unsigned long)(((uint8_t*)temp->next - (uint8_t*)temp)) >= HEADER_FENCE_SIZE(size))
-            {
-                header_setup_debug(temp, size, temp->prev, temp->next, fileline, filename);
-                pthread_mutex_unlock(&mutex);
-                return memblock;
-            }
-            else                   // if not, there is a need to change the block's location
-            {
-                pthread_mutex_unlock(&mutex);
-                void *new_block_location = heap_malloc_debug(size, fileline, filename);
-                pthread_mutex_lock(&mutex);
-                if(!new_block_location)
-                {
-                    pthread_mutex_unlock(&mutex);
-                    return NULL;
-                }
-
-                memcpy(new_block_location, memblock, temp->size);
-                pthread_mutex_unlock(&mutex);
-                heap_free((uint8_t*)temp + header_size + FENCE_SIZE);
-                pthread_mutex_lock(&mutex);
-                ((mem_header*)((uint8_t*)new_block_location - header_size - FENCE_SIZE))->control_sum = calculate_control_size((uint8_t*)new_block_location - header_size - FENCE_SIZE);
-                pthread_mutex_unlock(&mutex);
-                return new_block_location;
-            }
-        }
-        else
-        {
-            unsigned long free_memory_on_heap = pages_allocated * PAGE_SIZE - (((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size)) - (uint8_t*)heap_start);
-
-            while(free_memory_on_heap < HEADER_FENCE_SIZE(size))
-            {
-                void* res = custom_sbrk(PAGE_SIZE);
-                if(res == (void*)-1)
-                {
-                    pthread_mutex_unlock(&mutex);
-                    return NULL;
-                }
-                else
-                {
-                    free_memory_on_heap += PAGE_SIZE;
-                    ++pages_allocated;
-                }
-            }
-            header_setup_debug(temp, size, temp->prev, NULL, fileline, filename);
-            pthread_mutex_unlock(&mutex);
-            return memblock;
-        }
-    }
-}
-
-void* heap_malloc_aligned_debug(size_t size, int fileline, const char* filename)
-{
-    if(!size || heap_validate() || !heap_start)
-    {
-        return NULL;
-    }
-    pthread_mutex_lock(&mutex);
-
-    if(heap_start && heap_is_empty == 1)  //empty heap
-    {
-        size_t offset_page = ALIGN((size_t)((uint8_t*)heap_start + header_size + FENCE_SIZE), PAGE_SIZE) - (size_t)((uint8_t*)heap_start + header_size + FENCE_SIZE);
-        size_t offset_word = ALIGN((size_t)((uint8_t*)heap_start + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)heap_start + header_size + FENCE_SIZE);
-        heap_is_empty = 0;
-        while(pages_allocated * PAGE_SIZE < HEADER_FENCE_SIZE(size) + offset_page)
-        {
-            void* temp = custom_sbrk(PAGE_SIZE);
-            if(temp == (void*)-1)
-            {
-                pthread_mutex_unlock(&mutex);
-                return NULL;
-            }
-            else
-                ++pages_allocated;
-        }
-
-        first_block = (mem_header*)((uint8_t*)heap_start + offset_word);
-        mem_header* first_block_allocated = first_block;     //first block will be free, it fits in the offset area of the block aligned for page size
-        mem_header* second_block = (mem_header*)((uint8_t*)heap_start + offset_page);  //the second is aligned to the page and with size given by user
-
-        header_setup_debug(first_block_allocated, offset_page - offset_word - header_size - 2 * FENCE_SIZE, NULL, second_block, fileline, filename);
-        first_block_allocated->free = 1;
-        first_block_allocated->control_sum = calculate_control_size((uint8_t*)first_block_allocated);
-        header_setup_debug(second_block, size, first_block, NULL, fileline, filename);
-
-        pthread_mutex_unlock(&mutex);
-        return (void*)((uint8_t*)second_block + FENCE_SIZE + header_size);
-    }
-
-    mem_header* temp = first_block;
-    while(temp)     // look for free blocks with enough size and right address
-    {
-        size_t offset = ALIGN((size_t)((uint8_t*)temp + header_size + FENCE_SIZE), PAGE_SIZE) - (size_t)((uint8_t*)temp + header_size + FENCE_SIZE);
-        if(temp->free && temp->size >= HEADER_FENCE_SIZE(size) + offset)
-        {
-            if(offset == 0)
-            {
-                size_t offset_new_block = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + header_size + FENCE_SIZE);
-                if(temp->next && (uintptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset_new_block + HEADER_FENCE_SIZE(1)) < (uintptr_t)temp->next)
-                {
-                    mem_header* new_block = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset_new_block);
-                    header_setup_debug(new_block, (uint8_t*)temp->next - ((uint8_t*)temp + HEADER_FENCE_SIZE(size) + offset_new_block) - header_size - 2 * FENCE_SIZE, temp, temp->next, fileline, filename);
-                    new_block->free = 1;
-                    new_block->control_sum = calculate_control_size((uint8_t*)new_block);
-                    temp->next->prev = new_block;
-                    temp->next->control_sum = calculate_control_size((uint8_t*)temp->next);
-                    header_setup_debug(temp, size, temp->prev, new_block, fileline, filename);
-                }
-                else
-                    header_setup_debug(temp, size, temp->prev, temp->next, fileline, filename);
-
-                pthread_mutex_unlock(&mutex);
-                return (void*)((uint8_t*)temp + header_size + FENCE_SIZE);
-            }
-            else
-            {
-                if(offset > HEADER_FENCE_SIZE(1))
-                {
-                    mem_header* new_block = (mem_header*)((uint8_t*)temp + offset);
-                    header_setup_debug(new_block, temp->size - offset - HEADER_FENCE_SIZE(0), temp, temp->next, fileline, filename);
-                    new_block->free = 1;
-                    new_block->control_sum = calculate_control_size((uint8_t*)new_block);
-                    temp->next->prev = new_block;
-                    temp->next->control_sum = calculate_control_size((uint8_t*)temp->next);
-                    header_setup_debug(temp, offset - header_size - 2 * FENCE_SIZE, temp->prev, new_block, fileline, filename);
-                    temp->free = 1;
-                    temp->control_sum = calculate_control_size((uint8_t*)temp);
-
-                    temp = temp->next;
-                    continue;
-                }
-                else
-                {
-                    temp = temp->next;
-                    continue;
-                }
-            }
-        }
-        if(temp->next)
-            temp = temp->next;
-        else        //if not present, see how much memory is free, and if not sufficient, request OS for more. check the result and then create new header
-        {
-            unsigned long free_memory_on_heap = pages_allocated * PAGE_SIZE - (((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size)) - (uint8_t*)heap_start);
-
-            while(free_memory_on_heap < HEADER_FENCE_SIZE(size))
-            {
-                void* res = custom_sbrk(PAGE_SIZE);
-                if(res == (void*)-1)
-                {
-                    pthread_mutex_unlock(&mutex);
-                    return NULL;
-                }
-                else
-                {
-                    free_memory_on_heap += PAGE_SIZE;
-                    ++pages_allocated;
-                }
-            }
-            if(IS_POINTER_DIVISIBLE_BY_4096((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE))
-            {
-                temp->next = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size));
-                header_setup_debug(temp->next, size, temp, NULL, fileline, filename);
-                header_setup_debug(temp, temp->size, temp->prev, temp->next, fileline, filename);
-
-                pthread_mutex_unlock(&mutex);
-                return (void*)((uint8_t*)temp->next + header_size + FENCE_SIZE);
-            }
-            else
-            {
-                offset = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE), PAGE_SIZE) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE);
-                while(free_memory_on_heap < HEADER_FENCE_SIZE(size) + offset)
-                {
-                    void* res = custom_sbrk(PAGE_SIZE);
-                    if(res == (void*)-1)
-                    {
-                        pthread_mutex_unlock(&mutex);
-                        return NULL;
-                    }
-                    else
-                    {
-                        free_memory_on_heap += PAGE_SIZE;
-                        ++pages_allocated;
-                    }
-                }
-                temp->next = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + offset);
-
-                size_t offset_new_block = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE);
-                if(offset > HEADER_FENCE_SIZE(1) + offset_new_block)
-                {
-                    mem_header* new_block_empty = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + offset_new_block);
-                    mem_header* new_block_allocated = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + offset);
-                    header_setup_debug(new_block_empty, offset - offset_new_block - HEADER_FENCE_SIZE(0), temp, new_block_allocated, fileline, filename);
-                    new_block_empty->free = 1;
-                    new_block_empty->control_sum = calculate_control_size((uint8_t*)new_block_empty);
-                    header_setup_debug(new_block_allocated, size, new_block_empty, NULL, fileline, filename);
-                    if(temp->free)
-                    {
-                        header_setup_debug(temp, temp->size, temp->prev, new_block_empty, fileline, filename);
-                        temp->free = 1;
-                        temp->control_sum = calculate_control_size((uint8_t*)temp);
-                    }
-                    else
-                        header_setup_debug(temp, temp->size, temp->prev, new_block_empty, fileline, filename);
-                    pthread_mutex_unlock(&mutex);
-                    return (void*)((uint8_t*)new_block_allocated + FENCE_SIZE + header_size);
-                }
-                header_setup_debug(temp->next, size, temp, NULL, fileline, filename);
-                if(temp->free)
-                {
-                    header_setup_debug(temp, temp->size, temp->prev, temp->next, fileline, filename);
-                    temp->free = 1;
-                    temp->control_sum = calculate_control_size((uint8_t*)temp);
-                }
-                else
-                    header_setup_debug(temp, temp->size, temp->prev, temp->next, fileline, filename);
-
-                pthread_mutex_unlock(&mutex);
-                return (void*)((uint8_t*)temp->next + FENCE_SIZE + header_size);
-            }
-        }
-    }
-
-    pthread_mutex_unlock(&mutex);
-    return NULL;
-}
-void* heap_calloc_aligned_debug(size_t number, size_t size, int fileline, const char* filename)
-{
-    if(!number || !size || heap_validate())
-    {
-        return NULL;
-    }
-
-    void* ptr = heap_malloc_aligned_debug(number * size, fileline, filename);
-    pthread_mutex_lock(&mutex);
-    if(ptr)
-    {
-        memset(ptr, 0, number * size);
-        pthread_mutex_unlock(&mutex);
-        return ptr;
-    }
-
-    pthread_mutex_unlock(&mutex);
-    return NULL;
-}
-void* heap_realloc_aligned_debug(void* memblock, size_t size, int fileline, const char* filename)
-{
-    if((!memblock && !size) || heap_validate())
-    {
-        return NULL;
-    }
-    if(size == 0)
-    {
-        heap_free(memblock);
-        return NULL;
-    }
-    if(!memblock)
-    {
-        return heap_malloc_aligned_debug(size, fileline, filename);
-    }
-    if(get_pointer_type(memblock) != pointer_valid)
-    {
-        return NULL;
-    }
-    pthread_mutex_lock(&mutex);
-
-    mem_header* temp = (mem_header*)((uint8_t*)memblock - FENCE_SIZE - header_size);
-    if(temp->size == size)    // new size == old size, nothing changes
-    {
-        pthread_mutex_unlock(&mutex);
-        return memblock;
-    }
-    if(temp->size > size)     // new size < old size, shrink the block and update control sum
-    {
-        if(temp->next && (uintptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(size) + HEADER_FENCE_SIZE(1)) < (uintptr_t)temp->next)
-        {
-            mem_header* new_block = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(size));
-            header_setup_debug(new_block, (uint8_t*)temp->next - ((uint8_t*)temp + HEADER_FENCE_SIZE(size)) - header_size - 2 * FENCE_SIZE, temp, temp->next, fileline, filename);
-            new_block->free = 1;
-            new_block->control_sum = calculate_control_size((uint8_t*)new_block);
-            header_setup_debug(temp, size, temp->prev, new_block, fileline, filename);
-        }
-        else
-            header_setup_debug(temp, size, temp->prev, temp->next, fileline, filename);
-
-        pthread_mutex_unlock(&mutex);
-        return memblock;
-    }
-    else
-    {
-        if(temp->next)         //check whether next block exists
-        {
-            // if so, check if its' size + size of curr block is enough to fit the new block
-            if(temp->next->free && (unsigned long)(((uint8_t*)temp->next + HEADER_FENCE_SIZE(temp->next->size) - (uint8_t*)temp)) >= HEADER_FENCE_SIZE(size))
-            {
-                header_setup_debug(temp, size, temp->prev, temp->next->next, fileline, filename);
-                pthread_mutex_unlock(&mutex);
-                return memblock;
-            }
-            else if((unsigned long)(((uint8_t*)temp->next - (uint8_t*)temp)) >= HEADER_FENCE_SIZE(size))
-            {
-                header_setup_debug(temp, size, temp->prev, temp->next, fileline, filename);
-                pthread_mutex_unlock(&mutex);
-                return memblock;
-            }
-            else                   // if not, there is a need to change the block's location
-            {
-                pthread_mutex_unlock(&mutex);
-                void *new_block_location = heap_malloc_aligned_debug(size, fileline, filename);
-                pthread_mutex_lock(&mutex);
-                if(!new_block_location)
-                {
-                    pthread_mutex_unlock(&mutex);
-                    return NULL;
-                }
-                memcpy(new_block_location, memblock, temp->size);
-                pthread_mutex_unlock(&mutex);
-                heap_free((uint8_t*)temp + header_size + FENCE_SIZE);
-                pthread_mutex_lock(&mutex);
-                ((mem_header*)((uint8_t*)new_block_location - header_size - FENCE_SIZE))->control_sum = calculate_control_size((uint8_t*)new_block_location - header_size - FENCE_SIZE);
-                pthread_mutex_unlock(&mutex);
-                return new_block_location;
-            }
-        }
-        else
-        {
-            unsigned long free_memory_on_heap = pages_allocated * PAGE_SIZE - (((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size)) - (uint8_t*)heap_start);
-
-            while(free_memory_on_heap < HEADER_FENCE_SIZE(size))
-            {
-                void* res = custom_sbrk(PAGE_SIZE);
-                if(res == (void*)-1)
-                {
-                    pthread_mutex_unlock(&mutex);
-                    return NULL;
-                }
-                else
-                {
-                    free_memory_on_heap += PAGE_SIZE;
-                    ++pages_allocated;
-                }
-            }
-            header_setup_debug(temp, size, temp->prev, NULL, fileline, filename);
-            pthread_mutex_unlock(&mutex);
-            return memblock;
-        }
-    }
-}
-
+#include "heap.h"
+
+struct arena arenas[ARENAS_MAX];                // arenas[0] is the main heap
+mem_header* main_page_last[HEAP_INDEX_PAGES];
+unsigned long main_page_map[HEAP_INDEX_PAGES / 64];
+mem_header* arena_page_last[ARENAS_MAX][ARENA_SIZE / PAGE_SIZE];
+unsigned long arena_page_map[ARENAS_MAX][ARENA_SIZE / PAGE_SIZE / 64];
+int arenas_count = 1;
+unsigned int arenas_next = 0;                   // round robin counter for thread to arena assignment
+_Thread_local int thread_arena = -1;
+unsigned long header_size = sizeof(mem_header);
+uint8_t thread_cache_enabled = 0;
+uint8_t slabs_enabled = 0;
+uint8_t remote_frees_enabled = 0;
+struct slab* slab_partial[SLAB_CLASSES];        // slabs with at least one free object
+struct slab* slab_unused;                       // pages of slab chunks not taken by any class
+unsigned long slab_objects[SLAB_CLASSES];       // allocated objects of every class
+unsigned long slab_page_map[HEAP_INDEX_PAGES / 64];     // bit p set <=> page p of the main heap, counted from its first whole page, is a slab
+pthread_mutex_t slab_mutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned long growth_min_pages = HEAP_GROWTH_MIN_PAGES;
+unsigned long growth_percent = HEAP_GROWTH_PERCENT;
+unsigned long trim_threshold = HEAP_TRIM_THRESHOLD;
+unsigned long trim_pad = HEAP_TRIM_PAD;
+enum validation_policy_t validation_policy = HEAP_VALIDATION_DEFAULT;
+unsigned int validation_interval = HEAP_VALIDATION_INTERVAL;
+unsigned long validation_calls = 0;
+unsigned long validation_budget = HEAP_VALIDATION_BUDGET;
+int validation_arena = 0;                       // arena heap_validate_step goes on with
+unsigned long validation_passes = 0;
+pthread_mutex_t validation_mutex = PTHREAD_MUTEX_INITIALIZER;   // one heap_validate_step at a time, the others skip
+enum placement_policy_t placement_policy = placement_good_fit;
+unsigned long sbrk_calls = 0;
+unsigned long peak_pages = 0;
+unsigned long heap_generation = 0;              // bumped by heap_clean, blocks cached before that are gone
+pthread_key_t thread_cache_key;
+pthread_once_t thread_cache_key_once = PTHREAD_ONCE_INIT;
+_Thread_local struct thread_cache thread_cache;
+struct debug_info debug_table_initial[DEBUG_TABLE_SIZE];
+struct debug_info* debug_table = debug_table_initial;  // open addressing by header address with linear probing
+unsigned long debug_table_capacity = DEBUG_TABLE_SIZE;
+unsigned long debug_table_count = 0;
+pthread_mutex_t debug_table_mutex = PTHREAD_MUTEX_INITIALIZER;
+FILE* trace_file = NULL;                        // set between heap_trace_start and heap_trace_stop
+struct timespec trace_start_time;
+pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned short trace_threads = 0;
+unsigned long trace_generation = 0;             // bumped by heap_trace_start, every trace numbers its threads anew
+_Thread_local unsigned short trace_thread = 0;  // given with the first record the thread writes in a trace
+_Thread_local unsigned long trace_thread_generation = 0;     // trace the thread got trace_thread in
+_Thread_local int trace_nesting = 0;            // calls heap.c makes to itself are not recorded
+
+
+void draw_fences(mem_header* address)
+{
+    uint64_t left = FENCE_LEFT, right = FENCE_RIGHT;
+    memcpy((uint8_t*)address + header_size, &left, FENCE_SIZE);
+    memcpy((uint8_t*)address + header_size + FENCE_SIZE + address->size, &right, FENCE_SIZE);
+}
+
+int fences_intact(const mem_header* address)     // one compare per fence, the right one may be unaligned
+{
+    uint64_t left, right;
+    memcpy(&left, (const uint8_t*)address + header_size, FENCE_SIZE);
+    memcpy(&right, (const uint8_t*)address + header_size + FENCE_SIZE + address->size, FENCE_SIZE);
+    return left == FENCE_LEFT && right == FENCE_RIGHT;
+}
+
+// CRC32C where the compiler may use the instruction, otherwise a rotate and xor per 32 bit word; either
+// way a change of any single byte, like of any single word, always changes the sum
+uint32_t calculate_control_size(const uint8_t* ptr)
+{
+    uint32_t words[CONTROL_SIZE / sizeof(uint32_t)];
+    memcpy(words, ptr, sizeof(words));
+    uint32_t control_sum = 0;
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    for(size_t i = 0; i < CONTROL_SIZE / sizeof(uint32_t); ++i)
+        control_sum = __builtin_ia32_crc32si(control_sum, words[i]);
+#else
+    for(size_t i = 0; i < CONTROL_SIZE / sizeof(uint32_t); ++i)
+        control_sum = (control_sum << 5 | control_sum >> 27) ^ words[i];
+#endif
+    return control_sum;
+}
+
+void header_setup(mem_header* header, unsigned long size, mem_header* prev, mem_header* next)
+{
+    header->size = size;
+    header->free = 0;
+    header->flags = 0;
+    header->next = next;
+    header->prev = prev;
+    header->control_sum = calculate_control_size((uint8_t*)header);
+
+    draw_fences(header);
+    block_index_insert(header);
+
+    if(prev)
+    {
+        prev->next = header;
+        prev->control_sum = calculate_control_size((uint8_t*)prev);
+    }
+    if(next)
+    {
+        next->prev = header;
+        next->control_sum = calculate_control_size((uint8_t*)next);
+    }
+}
+
+void header_resize(mem_header* header, unsigned long size, mem_header* next)     // the block stays where it is, so does its debug info
+{
+    uint8_t flags = header->flags;
+    header_setup(header, size, header->prev, next);
+    header->flags = flags;
+    header->control_sum = calculate_control_size((uint8_t*)header);
+}
+
+int free_list_index(unsigned long size)
+{
+    int index = (int)(sizeof(unsigned long) * 8 - 1) - __builtin_clzl(size);
+    return index < FREE_LISTS_COUNT ? index : FREE_LISTS_COUNT - 1;
+}
+
+void free_list_insert(struct arena* arena, mem_header* block)
+{
+    arena->stats.free_bytes += block->size;
+    ++arena->stats.free_blocks;
+    ++arena->stats.free_by_class[free_list_index(block->size)];
+    if(block->size < FREE_LIST_MIN_SIZE)      // no room for the links, block will be reclaimed by coalescing
+        return;
+    if(block->size >= LARGE_OBJECT_THRESHOLD)
+    {
+        arena->free_tree = free_tree_insert(arena->free_tree, block);
+        return;
+    }
+    int index = free_list_index(block->size);
+    struct free_links* links = FREE_LINKS(block);
+    links->next_free = NULL;
+    links->prev_free = arena->free_lists_tail[index];
+    if(arena->free_lists_tail[index])
+        FREE_LINKS(arena->free_lists_tail[index])->next_free = block;
+    else
+        arena->free_lists[index] = block;
+    arena->free_lists_tail[index] = block;
+    arena->free_lists_map |= 1UL << index;
+}
+
+void free_list_remove(struct arena* arena, mem_header* block)
+{
+    debug_info_remove(block);       // the block is reused or merged, whatever a debug split left for it is stale
+    arena->stats.free_bytes -= block->size;
+    --arena->stats.free_blocks;
+    --arena->stats.free_by_class[free_list_index(block->size)];
+    if(block->size < FREE_LIST_MIN_SIZE)
+        return;
+    if(block->size >= LARGE_OBJECT_THRESHOLD)
+    {
+        arena->free_tree = free_tree_remove(arena->free_tree, block);
+        return;
+    }
+    int index = free_list_index(block->size);
+    struct free_links* links = FREE_LINKS(block);
+    if(links->prev_free)
+        FREE_LINKS(links->prev_free)->next_free = links->next_free;
+    else
+        arena->free_lists[index] = links->next_free;
+    if(links->next_free)
+        FREE_LINKS(links->next_free)->prev_free = links->prev_free;
+    else
+        arena->free_lists_tail[index] = links->prev_free;
+    if(!arena->free_lists[index])
+        arena->free_lists_map &= ~(1UL << index);
+}
+
+int free_tree_less(const mem_header* block, unsigned long size, const void* address)
+{
+    return block->size < size || (block->size == size && (const uint8_t*)block < (const uint8_t*)address);
+}
+
+unsigned long free_tree_priority(const mem_header* block)
+{
+    return (unsigned long)(((uintptr_t)block >> 3) * 0x9E3779B97F4A7C15ULL);
+}
+
+mem_header* free_tree_insert(mem_header* root, mem_header* block)
+{
+    if(!root)
+    {
+        FREE_TREE_NODE(block)->left = NULL;
+        FREE_TREE_NODE(block)->right = NULL;
+        return block;
+    }
+    struct free_tree_node* node = FREE_TREE_NODE(root);
+    if(free_tree_less(block, root->size, root))
+    {
+        node->left = free_tree_insert(node->left, block);
+        if(free_tree_priority(node->left) > free_tree_priority(root))     // rotate right
+        {
+            mem_header* left = node->left;
+            node->left = FREE_TREE_NODE(left)->right;
+            FREE_TREE_NODE(left)->right = root;
+            return left;
+        }
+    }
+    else
+    {
+        node->right = free_tree_insert(node->right, block);
+        if(free_tree_priority(node->right) > free_tree_priority(root))     // rotate left
+        {
+            mem_header* right = node->right;
+            node->right = FREE_TREE_NODE(right)->left;
+            FREE_TREE_NODE(right)->left = root;
+            return right;
+        }
+    }
+    return root;
+}
+
+mem_header* free_tree_merge(mem_header* left, mem_header* right)     // every key in left is smaller than any in right
+{
+    if(!left)
+        return right;
+    if(!right)
+        return left;
+    if(free_tree_priority(left) > free_tree_priority(right))
+    {
+        FREE_TREE_NODE(left)->right = free_tree_merge(FREE_TREE_NODE(left)->right, right);
+        return left;
+    }
+    FREE_TREE_NODE(right)->left = free_tree_merge(left, FREE_TREE_NODE(right)->left);
+    return right;
+}
+
+mem_header* free_tree_remove(mem_header* root, mem_header* block)
+{
+    if(!root)
+        return NULL;
+    struct free_tree_node* node = FREE_TREE_NODE(root);
+    if(root == block)
+        return free_tree_merge(node->left, node->right);
+    if(free_tree_less(block, root->size, root))
+        node->left = free_tree_remove(node->left, block);
+    else
+        node->right = free_tree_remove(node->right, block);
+    return root;
+}
+
+mem_header* free_tree_lower_bound(mem_header* root, unsigned long size, const void* address)     // smallest block not less than (size, address)
+{
+    mem_header* found = NULL;
+    while(root)
+    {
+        if(free_tree_less(root, size, address))
+            root = FREE_TREE_NODE(root)->right;
+        else
+        {
+            found = root;
+            root = FREE_TREE_NODE(root)->left;
+        }
+    }
+    return found;
+}
+
+int free_list_fits(mem_header* block, size_t required, size_t alignment)
+{
+    size_t offset = heap_aligned_header((uint8_t*)block, alignment) - (uint8_t*)block;
+    return block->size >= required + offset;
+}
+
+uint8_t* heap_aligned_header(uint8_t* from, size_t alignment)     // first header at or after from with aligned data and a gap that can be a free block
+{
+    uint8_t* header = (uint8_t*)ALIGN((uintptr_t)(from + header_size + FENCE_SIZE), alignment) - header_size - FENCE_SIZE;
+    while(header != from && (size_t)(header - from) < HEADER_FENCE_SIZE(WORD_LEN))
+        header += alignment;
+    return header;
+}
+
+mem_header* free_list_find(struct arena* arena, size_t size, size_t alignment)
+{
+    size_t required = alignment == WORD_LEN ? size : HEADER_FENCE_SIZE(size);
+
+    if(placement_policy == placement_first_fit || placement_policy == placement_next_fit)     // walk the blocks in address order
+    {
+        mem_header* start = placement_policy == placement_next_fit && arena->rover ? arena->rover : arena->first_block;
+        mem_header* temp = start;
+        do
+        {
+            if(temp->free && free_list_fits(temp, required, alignment))
+            {
+                arena->rover = temp;
+                return temp;
+            }
+            temp = temp->next ? temp->next : arena->first_block;
+        } while(temp != start);
+        return NULL;
+    }
+
+    if(required < LARGE_OBJECT_THRESHOLD)
+    {
+        mem_header* temp = free_list_find_small(arena, required, alignment);
+        if(temp)
+            return temp;
+    }
+
+    // tightest fit from the tree; small requests only split its blocks when no free list has one,
+    // otherwise memory freed in large runs would never be used again by them
+    mem_header* temp = free_tree_lower_bound(arena->free_tree, required, NULL);
+    while(temp && !free_list_fits(temp, required, alignment))
+        temp = free_tree_lower_bound(arena->free_tree, temp->size, (uint8_t*)temp + 1);
+    return temp;
+}
+
+mem_header* free_list_find_small(struct arena* arena, size_t required, size_t alignment)
+{
+    unsigned long map = arena->free_lists_map & (~0UL << free_list_index(required));
+    while(map)      // size classes are disjoint, so the first class with any fit also holds the best one
+    {
+        mem_header* best = NULL;
+        for(mem_header* temp = arena->free_lists[__builtin_ctzl(map)]; temp; temp = FREE_LINKS(temp)->next_free)
+        {
+            if(free_list_fits(temp, required, alignment) && (!best || temp->size < best->size))
+            {
+                best = temp;
+                if(placement_policy == placement_good_fit)
+                    break;
+            }
+        }
+        if(best)
+            return best;
+        map &= map - 1;
+    }
+    return NULL;
+}
+
+mem_header* large_object_find(struct arena* arena, size_t size)
+{
+    return free_tree_lower_bound(arena->free_tree, size, NULL);
+}
+
+unsigned long debug_table_slot(const mem_header* header)
+{
+    return (unsigned long)((((uintptr_t)header >> 3) * 0x9E3779B97F4A7C15ULL) >> 32) & (debug_table_capacity - 1);
+}
+
+// debug blocks live in the main heap, so the table only changes under its lock; a table bigger than
+// debug_table_initial is a used block of the main heap that no statistic counts, like the region of a
+// thread arena, and goes away with heap_clean
+int debug_table_resize_locked(unsigned long capacity)
+{
+    struct debug_info* table = capacity == DEBUG_TABLE_SIZE ? debug_table_initial : heap_malloc_locked(&arenas[0], capacity * sizeof(struct debug_info));
+    if(!table)
+        return -1;
+    memset(table, 0, capacity * sizeof(struct debug_info));
+
+    pthread_mutex_lock(&debug_table_mutex);
+    struct debug_info* old = debug_table;
+    unsigned long old_capacity = debug_table_capacity;
+    debug_table = table;
+    debug_table_capacity = capacity;
+    for(unsigned long i = 0; i < old_capacity; ++i)
+    {
+        if(!old[i].header)
+            continue;
+        unsigned long slot = debug_table_slot(old[i].header);
+        while(table[slot].header)
+            slot = (slot + 1) & (capacity - 1);
+        table[slot] = old[i];
+    }
+    pthread_mutex_unlock(&debug_table_mutex);
+    if(old != debug_table_initial)
+        heap_free_locked(&arenas[0], old);
+    return 0;
+}
+
+int debug_table_reserve_locked(void)     // room for one more entry, -1 when the table is full and cannot grow
+{
+    if((debug_table_count + 1) * 4 <= debug_table_capacity * 3)
+        return 0;
+    return debug_table_resize_locked(debug_table_capacity * 2);
+}
+
+void debug_table_shrink_locked(void)     // with the main heap lock, once most debug blocks are gone, so the table does not pin memory
+{
+    unsigned long capacity = debug_table_capacity;
+    while(capacity > DEBUG_TABLE_SIZE && debug_table_count * 8 <= capacity)
+        capacity /= 2;
+    if(capacity != debug_table_capacity)
+        debug_table_resize_locked(capacity);     // a failure keeps the bigger table
+}
+
+int debug_table_block(const mem_header* header)     // the grown debug table, not a user block
+{
+    return debug_table != debug_table_initial && (const uint8_t*)header + header_size + FENCE_SIZE == (const uint8_t*)debug_table;
+}
+
+void debug_info_set(mem_header* header, int fileline, const char* filename)     // after debug_table_reserve_locked
+{
+    pthread_mutex_lock(&debug_table_mutex);
+    unsigned long slot = debug_table_slot(header);
+    while(debug_table[slot].header && debug_table[slot].header != header)
+        slot = (slot + 1) & (debug_table_capacity - 1);
+    if(!debug_table[slot].header)
+        ++debug_table_count;
+    debug_table[slot].header = header;
+    debug_table[slot].fileline = fileline;
+    debug_table[slot].filename = filename;
+    pthread_mutex_unlock(&debug_table_mutex);
+    header->flags |= HEADER_DEBUG_INFO;
+    header->control_sum = calculate_control_size((uint8_t*)header);
+}
+
+void debug_info_remove(mem_header* header)
+{
+    if(!(header->flags & HEADER_DEBUG_INFO))     // release blocks never touch the table or its lock
+        return;
+    header->flags &= ~HEADER_DEBUG_INFO;
+    header->control_sum = calculate_control_size((uint8_t*)header);
+    pthread_mutex_lock(&debug_table_mutex);
+    unsigned long mask = debug_table_capacity - 1;
+    unsigned long hole = debug_table_slot(header);
+    while(debug_table[hole].header && debug_table[hole].header != header)
+        hole = (hole + 1) & mask;
+    if(debug_table[hole].header)
+    {
+        --debug_table_count;
+        // shift back the entries of the probe chain that may move into the hole
+        for(unsigned long slot = (hole + 1) & mask; debug_table[slot].header; slot = (slot + 1) & mask)
+        {
+            unsigned long home = debug_table_slot(debug_table[slot].header);
+            if(((slot - home) & mask) >= ((slot - hole) & mask))
+            {
+                debug_table[hole] = debug_table[slot];
+                hole = slot;
+            }
+        }
+        debug_table[hole].header = NULL;
+    }
+    pthread_mutex_unlock(&debug_table_mutex);
+}
+
+int heap_get_debug_info(const void* memblock, int* fileline, const char** filename)
+{
+    if(get_pointer_type(memblock) != pointer_valid)
+        return 0;
+    return debug_info_get((const mem_header*)((const uint8_t*)memblock - FENCE_SIZE - header_size), fileline, filename);
+}
+
+int debug_info_get(const mem_header* header, int* fileline, const char** filename)
+{
+    if(!(header->flags & HEADER_DEBUG_INFO))
+        return 0;
+    pthread_mutex_lock(&debug_table_mutex);
+    unsigned long slot = debug_table_slot(header);
+    while(debug_table[slot].header && debug_table[slot].header != header)
+        slot = (slot + 1) & (debug_table_capacity - 1);
+    int found = debug_table[slot].header != NULL;
+    if(found)
+    {
+        if(fileline)
+            *fileline = debug_table[slot].fileline;
+        if(filename)
+            *filename = debug_table[slot].filename;
+    }
+    pthread_mutex_unlock(&debug_table_mutex);
+    return found;
+}
+
+void block_index_insert(mem_header* header)
+{
+    struct arena* arena = arena_of(header);
+    unsigned long page = ((uint8_t*)header - (uint8_t*)arena->start) / PAGE_SIZE;
+    if(page >= arena->index_pages)
+        return;
+    if(!arena->page_last[page] || (uint8_t*)arena->page_last[page] < (uint8_t*)header)
+        arena->page_last[page] = header;
+    arena->page_map[page / 64] |= 1UL << (page % 64);
+}
+
+void block_index_remove(mem_header* header)     // header is about to be merged into its predecessor
+{
+    struct arena* arena = arena_of(header);
+    if(arena->rover == header)
+        arena->rover = header->prev;
+    if(arena->validate_cursor == header)
+        arena->validate_cursor = header->prev;
+    unsigned long page = ((uint8_t*)header - (uint8_t*)arena->start) / PAGE_SIZE;
+    if(page >= arena->index_pages || arena->page_last[page] != header)
+        return;
+    if(header->prev && (unsigned long)((uint8_t*)header->prev - (uint8_t*)arena->start) / PAGE_SIZE == page)
+        arena->page_last[page] = header->prev;
+    else
+    {
+        arena->page_last[page] = NULL;
+        arena->page_map[page / 64] &= ~(1UL << (page % 64));
+    }
+}
+
+mem_header* block_index_find(struct arena* arena, const void* pointer)     // the last block starting at or before pointer
+{
+    unsigned long page = ((uint8_t*)pointer - (uint8_t*)arena->start) / PAGE_SIZE;
+    if(page >= arena->index_pages)
+        return NULL;
+
+    mem_header* temp = arena->page_last[page];
+    if(!temp)     // pointer lies inside a block that started in one of the previous pages
+    {
+        unsigned long word = page / 64;
+        unsigned long map = arena->page_map[word] & ((1UL << (page % 64)) - 1);
+        while(!map && word)
+            map = arena->page_map[--word];
+        if(!map)
+            return NULL;
+        temp = arena->page_last[word * 64 + (sizeof(unsigned long) * 8 - 1) - __builtin_clzl(map)];
+    }
+    while(temp && (uint8_t*)temp > (uint8_t*)pointer)
+        temp = temp->prev;
+    return temp;
+}
+
+unsigned long heap_grow(struct arena* arena, unsigned long needed)
+{
+    if(arena != &arenas[0])     // thread arenas have a fixed size
+        return 0;
+    if(needed > (unsigned long)INTPTR_MAX - PAGE_SIZE)     // ALIGN would wrap, or custom_sbrk would see a negative delta
+        return 0;
+    unsigned long pages = ALIGN(needed, PAGE_SIZE) / PAGE_SIZE;
+    unsigned long reserve = arena->pages_allocated * growth_percent / 100;     // over-reserve, so the next requests do not need custom_sbrk
+    if(reserve < growth_min_pages)
+        reserve = growth_min_pages;
+    if(reserve > pages && custom_sbrk(reserve * PAGE_SIZE) != (void*)-1)
+        pages = reserve;
+    else if(custom_sbrk(pages * PAGE_SIZE) == (void*)-1)
+        return 0;
+    arena->pages_allocated += pages;
+    ++sbrk_calls;
+    if(peak_pages < arena->pages_allocated)
+        peak_pages = arena->pages_allocated;
+    return pages * PAGE_SIZE;
+}
+
+void heap_set_growth(unsigned long min_pages, unsigned long percent)
+{
+    growth_min_pages = min_pages;
+    growth_percent = percent;
+}
+
+int heap_setup(void)
+{
+    struct arena* arena = &arenas[0];
+    arena->start = custom_sbrk(PAGE_SIZE);
+    if(arena->start == (void*)-1)
+        return -1;
+    arena->pages_allocated = 1;
+    sbrk_calls = 1;
+    peak_pages = 1;
+    memset(&arena->stats, 0, sizeof(arena->stats));
+    arena->first_block = NULL;
+    arena->last_block = NULL;
+    arena->is_empty = 1;
+    memset(arena->free_lists, 0, sizeof(arena->free_lists));
+    memset(arena->free_lists_tail, 0, sizeof(arena->free_lists_tail));
+    arena->free_lists_map = 0;
+    arena->free_tree = NULL;
+    arena->page_last = main_page_last;
+    arena->page_map = main_page_map;
+    arena->rover = NULL;
+    arena->validate_cursor = NULL;
+    arena->remote_frees = NULL;
+    arena->index_pages = HEAP_INDEX_PAGES;
+    validation_arena = 0;
+    validation_passes = 0;
+    memset(main_page_last, 0, sizeof(main_page_last));
+    memset(main_page_map, 0, sizeof(main_page_map));
+    memset(slab_partial, 0, sizeof(slab_partial));
+    memset(slab_objects, 0, sizeof(slab_objects));
+    memset(slab_page_map, 0, sizeof(slab_page_map));
+    slab_unused = NULL;
+    memset(debug_table_initial, 0, sizeof(debug_table_initial));
+    debug_table = debug_table_initial;     // a grown table went away with the old heap
+    debug_table_capacity = DEBUG_TABLE_SIZE;
+    debug_table_count = 0;
+    pthread_mutex_init(&arena->mutex, NULL);
+
+    return 0;
+}
+
+void heap_get_default_config(struct heap_config* config)
+{
+    config->placement = placement_good_fit;
+    config->validation = HEAP_VALIDATION_DEFAULT;
+    config->validation_interval = HEAP_VALIDATION_INTERVAL;
+    config->validation_budget = HEAP_VALIDATION_BUDGET;
+    config->growth_min_pages = HEAP_GROWTH_MIN_PAGES;
+    config->growth_percent = HEAP_GROWTH_PERCENT;
+    config->trim_threshold = HEAP_TRIM_THRESHOLD;
+    config->trim_pad = HEAP_TRIM_PAD;
+    config->thread_cache = 0;
+    config->arenas = 1;
+    config->slabs = 0;
+    config->remote_frees = 0;
+}
+
+int heap_setup_ex(const struct heap_config* config)     // NULL gives the defaults
+{
+    struct heap_config defaults;
+    if(!config)
+    {
+        heap_get_default_config(&defaults);
+        config = &defaults;
+    }
+    heap_set_placement(config->placement);
+    heap_set_validation(config->validation, config->validation_interval);
+    heap_set_validation_budget(config->validation_budget);
+    heap_set_growth(config->growth_min_pages, config->growth_percent);
+    heap_set_trim(config->trim_threshold, config->trim_pad);
+    heap_set_arenas(config->arenas);
+    heap_set_slabs(config->slabs);
+    heap_set_remote_frees(config->remote_frees);
+    int status = heap_setup();
+    if(status == 0)
+        heap_set_thread_cache(config->thread_cache);
+    return status;
+}
+
+void heap_set_placement(enum placement_policy_t policy)
+{
+    placement_policy = policy;
+}
+
+double heap_get_fragmentation(void)     // 1 - largest free block / all free blocks, the unused end of the heap does not count
+{
+    struct heap_stats stats;
+    return heap_get_stats(&stats) ? 0 : stats.fragmentation;
+}
+
+int heap_get_stats(struct heap_stats* stats)
+{
+    if(!stats || !arenas[0].start)
+        return -1;
+
+    memset(stats, 0, sizeof(*stats));
+    unsigned long free_largest = 0;
+    for(int i = 0; i < ARENAS_MAX; ++i)
+    {
+        struct arena* arena = &arenas[i];
+        if(!__atomic_load_n(&arena->start, __ATOMIC_ACQUIRE))
+            continue;
+        pthread_mutex_lock(&arena->mutex);     // not arena_lock, polling must not count as contention
+        stats->in_use += arena->stats.used_bytes;
+        stats->used_blocks += arena->stats.used_blocks;
+        stats->free += arena->stats.free_bytes;
+        stats->free_blocks += arena->stats.free_blocks;
+        for(int index = 0; index < FREE_LISTS_COUNT; ++index)
+        {
+            stats->used_by_class[index] += arena->stats.used_by_class[index];
+            stats->free_by_class[index] += arena->stats.free_by_class[index];
+        }
+        stats->lock_contentions += __atomic_load_n(&arena->stats.contentions, __ATOMIC_RELAXED);
+
+        // the largest free block is the rightmost one of the tree, or else in the highest free list
+        mem_header* largest = arena->free_tree;
+        while(largest && FREE_TREE_NODE(largest)->right)
+            largest = FREE_TREE_NODE(largest)->right;
+        if(!largest && arena->free_lists_map)
+        {
+            int index = (int)(sizeof(unsigned long) * 8 - 1) - __builtin_clzl(arena->free_lists_map);
+            for(mem_header* temp = arena->free_lists[index]; temp; temp = FREE_LINKS(temp)->next_free)
+            {
+                if(!largest || largest->size < temp->size)
+                    largest = temp;
+            }
+        }
+        if(largest && free_largest < largest->size)
+            free_largest = largest->size;
+        if(!i && debug_table != debug_table_initial)     // the grown debug table is no user block either
+        {
+            stats->in_use -= debug_table_capacity * sizeof(struct debug_info);
+            --stats->used_blocks;
+            --stats->used_by_class[free_list_index(debug_table_capacity * sizeof(struct debug_info))];
+        }
+        pthread_mutex_unlock(&arena->mutex);
+
+        if(i)     // every thread arena is a single used block of the main heap as well
+        {
+            stats->in_use -= ARENA_SIZE;
+            --stats->used_blocks;
+            --stats->used_by_class[free_list_index(ARENA_SIZE)];
+        }
+    }
+    stats->footprint = arenas[0].pages_allocated * PAGE_SIZE;
+    stats->peak_footprint = peak_pages * PAGE_SIZE;
+    stats->sbrk_calls = sbrk_calls;
+    stats->validation_passes = __atomic_load_n(&validation_passes, __ATOMIC_RELAXED);
+    stats->fragmentation = stats->free ? 1.0 - (double)free_largest / (double)stats->free : 0;
+    return 0;
+}
+
+void stats_used_change(struct arena* arena, unsigned long old_size, unsigned long new_size)     // a size of 0 stands for no block
+{
+    if(old_size)
+    {
+        arena->stats.used_bytes -= old_size;
+        --arena->stats.used_blocks;
+        --arena->stats.used_by_class[free_list_index(old_size)];
+    }
+    if(new_size)
+    {
+        arena->stats.used_bytes += new_size;
+        ++arena->stats.used_blocks;
+        ++arena->stats.used_by_class[free_list_index(new_size)];
+    }
+}
+
+void arena_lock(struct arena* arena)
+{
+    if(pthread_mutex_trylock(&arena->mutex))
+    {
+        __atomic_fetch_add(&arena->stats.contentions, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&arena->mutex);
+    }
+}
+
+void heap_clean(void)
+{
+    struct arena* arena = &arenas[0];
+    if(arena->start == NULL)
+        return;
+    for(int i = 1; i < ARENAS_MAX; ++i)     // thread arenas live inside the main heap, nothing to give back
+    {
+        if(arenas[i].start)
+        {
+            arenas[i].start = NULL;
+            pthread_mutex_destroy(&arenas[i].mutex);
+        }
+    }
+    unsigned long memory_used = arena->pages_allocated * PAGE_SIZE;
+    custom_sbrk((-1) * memory_used);
+    arena->start = NULL;
+    arena->first_block = NULL;
+    arena->last_block = NULL;
+    arena->is_empty = 1;
+    ++heap_generation;
+    pthread_mutex_destroy(&arena->mutex);
+}
+
+void* heap_malloc_locked(struct arena* arena, size_t size)
+{
+    if(arena->start && arena->is_empty == 1)  //empty heap
+    {
+        size_t offset = ALIGN((size_t)((uint8_t*)arena->start + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)arena->start + header_size + FENCE_SIZE);
+        if(arena->pages_allocated * PAGE_SIZE < HEADER_FENCE_SIZE(size) + offset && !heap_grow(arena, HEADER_FENCE_SIZE(size) + offset - arena->pages_allocated * PAGE_SIZE))
+        {
+            return NULL;
+        }
+        arena->is_empty = 0;
+
+        arena->first_block = (mem_header*)((uint8_t*)arena->start + offset);
+        mem_header* first_block_allocated = arena->first_block;
+        header_setup(first_block_allocated, size, NULL, NULL);
+        arena->last_block = arena->first_block;
+        stats_used_change(arena, 0, size);
+        return (void*)((uint8_t*)first_block_allocated + FENCE_SIZE + header_size);
+    }
+
+    mem_header* temp;
+    size_t carved = size;
+    if(size >= LARGE_OBJECT_THRESHOLD)      // large objects take whole pages, so their leftovers stay page-granular too
+    {
+        temp = large_object_find(arena, size);
+        if(temp && temp->size >= ALIGN(HEADER_FENCE_SIZE(size), PAGE_SIZE) - HEADER_FENCE_SIZE(0) + HEADER_FENCE_SIZE(LARGE_OBJECT_THRESHOLD))
+            carved = ALIGN(HEADER_FENCE_SIZE(size), PAGE_SIZE) - HEADER_FENCE_SIZE(0);
+    }
+    else
+    {
+        temp = free_list_find(arena, size, WORD_LEN);
+        if(!temp && arena->last_block->free && arena->last_block->size >= size)     // the free end of the heap is shared by both
+            temp = arena->last_block;
+    }
+    if(temp)     // reuse a free block with enough size and right address
+    {
+        free_list_remove(arena, temp);
+        size_t offset = ALIGN((size_t)((uint8_t*)temp + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + header_size + FENCE_SIZE);
+        size_t offset_new_block = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(carved) + offset + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(carved) + offset + header_size + FENCE_SIZE);
+        if(temp->next && (uintptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(carved) + offset + offset_new_block + HEADER_FENCE_SIZE(1)) < (uintptr_t)temp->next)
+        {
+            mem_header* new_block = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(carved) + offset + offset_new_block);
+            header_setup(new_block, (uint8_t*)temp->next - ((uint8_t*)temp + HEADER_FENCE_SIZE(carved) + offset + offset_new_block) - header_size - 2 * FENCE_SIZE, temp, temp->next);
+            new_block->free = 1;
+            new_block->control_sum = calculate_control_size((uint8_t*)new_block);
+            free_list_insert(arena, new_block);
+            header_setup(temp, size, temp->prev, new_block);
+        }
+        else
+            header_setup(temp, size, temp->prev, temp->next);
+        stats_used_change(arena, 0, size);
+        return (void*)((uint8_t*)temp + header_size + FENCE_SIZE);
+    }
+
+    temp = arena->last_block;     //no free block fits, see how much memory is free after the last block, and if not sufficient, request OS for more. check the result and then create new header
+    unsigned long free_memory_on_heap = arena->pages_allocated * PAGE_SIZE - (((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size)) - (uint8_t*)arena->start);
+
+    if(free_memory_on_heap < HEADER_FENCE_SIZE(size))
+    {
+        unsigned long grown = heap_grow(arena, HEADER_FENCE_SIZE(size) - free_memory_on_heap);
+        if(!grown)
+        {
+            return NULL;
+        }
+        free_memory_on_heap += grown;
+    }
+    if(IS_POINTER_DIVISIBLE_BY_WORD((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE))
+    {
+        temp->next = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size));
+        header_setup(temp->next, size, temp, NULL);
+
+        arena->last_block = temp->next;
+        stats_used_change(arena, 0, size);
+        return (void*)((uint8_t*)temp->next + header_size + FENCE_SIZE);
+    }
+    else
+    {
+        size_t offset = ALIGN((size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE), WORD_LEN) - (size_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + header_size + FENCE_SIZE);
+
+        if(free_memory_on_heap < HEADER_FENCE_SIZE(size) + offset)
+        {
+            unsigned long grown = heap_grow(arena, HEADER_FENCE_SIZE(size) + offset - free_memory_on_heap);
+            if(!grown)
+            {
+                return NULL;
+            }
+            free_memory_on_heap += grown;
+        }
+        temp->next = (mem_header*)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) + offset);
+        header_setup(temp->next, size, temp, NULL);
+
+        arena->last_block = temp->next;
+        stats_used_change(arena, 0, size);
+        return (void*)((uint8_t*)temp->next + FENCE_SIZE + header_size);
+    }
+}
+
+static inline void* heap_alloc_locked(struct arena* arena, size_t size, size_t alignment)
+{
+    return alignment <= WORD_LEN ? heap_malloc_locked(arena, size) : heap_memalign_locked(arena, alignment, size);
+}
+
+// the engine behind every malloc, calloc and realloc variant; the public entry points pass constant
+// alignment and filename, so the compiler folds away the branches they do not need.
+// blocks with a bigger alignment or a recorded call site live in the main heap, the rest may use
+// thread caches, slabs and thread arenas
+static inline void* heap_alloc_untraced(size_t size, size_t alignment, int fileline, const char* filename)
+{
+    int plain = alignment <= WORD_LEN && !filename;
+    if(!size || size > HEAP_MAX_REQUEST || alignment > HEAP_MAX_REQUEST)
+        return NULL;
+    void* ptr = plain ? thread_cache_malloc(size) : NULL;
+    if(ptr)
+        return ptr;
+    if(heap_validate_policy(0) || !arenas[0].start)
+        return NULL;
+    if(plain && (ptr = slab_malloc(size)))
+        return ptr;
+
+    struct arena* arena = plain ? arena_get(size) : &arenas[0];
+    arena_lock(arena);
+    remote_free_drain_locked(arena);
+    if(!filename || !debug_table_reserve_locked())     // a debug block whose call site cannot be kept is not made
+        ptr = heap_alloc_locked(arena, size, alignment);
+    if(ptr && filename)
+        debug_info_set((mem_header*)((uint8_t*)ptr - FENCE_SIZE - header_size), fileline, filename);
+    pthread_mutex_unlock(&arena->mutex);
+    if(!ptr && arena != &arenas[0])     // thread arena is full, fall back to the main heap
+    {
+        arena = &arenas[0];
+        arena_lock(arena);
+        ptr = heap_malloc_locked(arena, size);
+        pthread_mutex_unlock(&arena->mutex);
+    }
+    return ptr;
+}
+
+static inline void* heap_alloc(size_t size, size_t alignment, int fileline, const char* filename)
+{
+    if(!__atomic_load_n(&trace_file, __ATOMIC_ACQUIRE))
+        return heap_alloc_untraced(size, alignment, fileline, filename);
+    trace_begin();
+    void* ptr = heap_alloc_untraced(size, alignment, fileline, filename);
+    trace_write(alignment > WORD_LEN ? trace_memalign : trace_malloc, ptr, NULL, size, alignment);
+    trace_end();
+    return ptr;
+}
+
+static inline void* heap_alloc_zeroed_untraced(size_t number, size_t size, size_t alignment, int fileline, const char* filename)
+{
+    if(!number || !size || number > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+
+    void* ptr = heap_alloc(number * size, alignment, fileline, filename);     // validates the heap itself
+    if(ptr)
+        memset(ptr, 0, number * size);     // the block is ours alone, no lock needed
+    return ptr;
+}
+
+static inline void* heap_alloc_zeroed(size_t number, size_t size, size_t alignment, int fileline, const char* filename)
+{
+    if(!__atomic_load_n(&trace_file, __ATOMIC_ACQUIRE))
+        return heap_alloc_zeroed_untraced(number, size, alignment, fileline, filename);
+    trace_begin();
+    void* ptr = heap_alloc_zeroed_untraced(number, size, alignment, fileline, filename);
+    trace_write(trace_calloc, ptr, NULL, number * size, alignment);
+    trace_end();
+    return ptr;
+}
+
+static inline void* heap_alloc_resize_untraced(void* memblock, size_t size, size_t alignment, int fileline, const char* filename)
+{
+    if((!memblock && !size) || heap_validate_policy(1))
+    {
+        return NULL;
+    }
+    if(size == 0)
+    {
+        heap_free(memblock);
+        return NULL;
+    }
+    if(!memblock)
+    {
+        return heap_alloc(size, alignment, fileline, filename);
+    }
+    if(size > HEAP_MAX_REQUEST)
+    {
+        return NULL;
+    }
+    if(get_pointer_type(memblock) != pointer_valid)
+    {
+        return NULL;
+    }
+
+    struct slab* slab = slab_of(memblock);
+    struct arena* arena = arena_of(memblock);
+    if(alignment <= WORD_LEN && !filename)
+    {
+        if(slab)     // objects keep their slab while the new size fits the class
+            return size <= slab->object_size ? memblock : heap_realloc_move(memblock, heap_malloc(size));
+    }
+    else if(slab || arena != &arenas[0] || ((uintptr_t)memblock & (alignment - 1)))     // such blocks belong to the main heap, at the right address
+        return heap_realloc_move(memblock, heap_alloc(size, alignment, fileline, filename));
+
+    arena_lock(arena);
+    remote_free_drain_locked(arena);
+    if(filename && debug_table_reserve_locked())
+    {
+        pthread_mutex_unlock(&arena->mutex);
+        return NULL;
+    }
+    mem_header* temp = (mem_header*)((uint8_t*)memblock - FENCE_SIZE - header_size);
+    void* ptr = memblock;
+    if(temp->size > size)     // new size < old size, shrink the block and give the rest back
+    {
+        stats_used_change(arena, temp->size, size);
+        header_resize(temp, size, temp->next);
+        block_split_locked(arena, temp);
+    }
+    else if(temp->size < size)
+        ptr = heap_realloc_locked(arena, temp, size, alignment);
+    if(ptr && filename)
+        debug_info_set((mem_header*)((uint8_t*)ptr - FENCE_SIZE - header_size), fileline, filename);
+    pthread_mutex_unlock(&arena->mutex);
+    if(!ptr && arena != &arenas[0])     // no room anywhere in the same arena, only the main heap is left
+        return heap_realloc_move(memblock, heap_malloc(size));
+    return ptr;
+}
+
+static inline void* heap_alloc_resize(void* memblock, size_t size, size_t alignment, int fileline, const char* filename)
+{
+    if(!__atomic_load_n(&trace_file, __ATOMIC_ACQUIRE))
+        return heap_alloc_resize_untraced(memblock, size, alignment, fileline, filename);
+    trace_begin();
+    void* ptr = heap_alloc_resize_untraced(memblock, size, alignment, fileline, filename);
+    trace_write(trace_realloc, ptr, memblock, size, alignment);
+    trace_end();
+    return ptr;
+}
+
+void* heap_malloc(size_t size)
+{
+    return heap_alloc(size, WORD_LEN, 0, NULL);
+}
+
+void* heap_calloc(size_t number, size_t size)
+{
+    return heap_alloc_zeroed(number, size, WORD_LEN, 0, NULL);
+}
+
+void* heap_realloc(void* memblock, size_t size)
+{
+    return heap_alloc_resize(memblock, size, WORD_LEN, 0, NULL);
+}
+
+void* heap_realloc_locked(struct arena* arena, mem_header* temp, size_t size, size_t alignment)     // grows temp, whatever way is cheapest
+{
+    void* memblock = (uint8_t*)temp + header_size + FENCE_SIZE;
+    uint8_t* heap_end = (uint8_t*)arena->start + arena->pages_allocated * PAGE_SIZE;
+    mem_header* next = temp->next && temp->next->free ? temp->next->next : temp->next;     // first used block behind, a free successor is absorbed
+    uint8_t* room_end = next ? (uint8_t*)next : heap_end;
+
+    if(!next && (uint8_t*)temp + HEADER_FENCE_SIZE(size) > heap_end && heap_grow(arena, (uint8_t*)temp + HEADER_FENCE_SIZE(size) - heap_end))
+        room_end = (uint8_t*)arena->start + arena->pages_allocated * PAGE_SIZE;     // the last block grows with the heap
+    if((uint8_t*)temp + HEADER_FENCE_SIZE(size) <= room_end)     // in place
+    {
+        if(temp->next != next)
+        {
+            free_list_remove(arena, temp->next);
+            block_index_remove(temp->next);
+        }
+        stats_used_change(arena, temp->size, size);
+        header_resize(temp, size, next);
+        if(!next)
+            arena->last_block = temp;
+        block_split_locked(arena, temp);
+        return memblock;
+    }
+
+    mem_header* prev = temp->prev;
+    if(prev && prev->free && (uint8_t*)prev + HEADER_FENCE_SIZE(size) <= room_end && !(((uintptr_t)prev + header_size + FENCE_SIZE) & (alignment - 1)))     // slide down into a free predecessor
+    {
+        free_list_remove(arena, prev);
+        if(temp->next != next)
+        {
+            free_list_remove(arena, temp->next);
+            block_index_remove(temp->next);
+        }
+        block_index_remove(temp);
+        debug_info_remove(temp);
+        stats_used_change(arena, temp->size, size);
+        memmove((uint8_t*)prev + header_size + FENCE_SIZE, memblock, temp->size);
+        header_setup(prev, size, prev->prev, next);
+        if(!next)
+            arena->last_block = prev;
+        block_split_locked(arena, prev);
+        return (uint8_t*)prev + header_size + FENCE_SIZE;
+    }
+
+    void* ptr = heap_alloc_locked(arena, size, alignment);     // move, still under the same lock
+    if(!ptr)
+        return NULL;
+    memcpy(ptr, memblock, temp->size);
+    heap_free_locked(arena, memblock);
+    return ptr;
+}
+
+void block_split_locked(struct arena* arena, mem_header* block)     // the room between block and the next header becomes a free block
+{
+    if(!block->next)     // behind the last block it is the free end of the heap anyway
+        return;
+    uint8_t* end = (uint8_t*)block + HEADER_FENCE_SIZE(block->size);
+    size_t offset = ALIGN((size_t)(end + header_size + FENCE_SIZE), WORD_LEN) - (size_t)(end + header_size + FENCE_SIZE);
+    if((uintptr_t)(end + offset + HEADER_FENCE_SIZE(1)) >= (uintptr_t)block->next)
+        return;
+    mem_header* new_block = (mem_header*)(end + offset);
+    header_setup(new_block, (uint8_t*)block->next - (uint8_t*)new_block - HEADER_FENCE_SIZE(0), block, block->next);
+    stats_used_change(arena, 0, new_block->size);     // heap_free_locked takes it off again
+    heap_free_locked(arena, (uint8_t*)new_block + header_size + FENCE_SIZE);     // merges with a free successor
+}
+
+void* heap_realloc_move(void* memblock, void* new_block_location)
+{
+    if(!new_block_location)
+        return NULL;
+    struct slab* old_slab = slab_of(memblock);
+    struct slab* new_slab = slab_of(new_block_location);
+    size_t old_size = old_slab ? old_slab->object_size : ((mem_header*)((uint8_t*)memblock - FENCE_SIZE - header_size))->size;
+    size_t new_size = new_slab ? new_slab->object_size : ((mem_header*)((uint8_t*)new_block_location - FENCE_SIZE - header_size))->size;
+    memcpy(new_block_location, memblock, old_size < new_size ? old_size : new_size);
+    heap_free(memblock);
+    return new_block_location;
+}
+
+mem_header* concat_memory_blocks(mem_header* p1, mem_header* p2)
+{
+    block_index_remove(p2);
+    p1->next = p2->next;
+    if(p2->next)
+        p2->next->prev = p1;
+    p1->size = p1->size + HEADER_FENCE_SIZE(p2->size);
+    return p1;
+}
+
+
+void heap_free_locked(struct arena* arena, void* memblock)
+{
+    mem_header* header = (mem_header*)((uint8_t*)memblock - FENCE_SIZE - header_size);
+    stats_used_change(arena, header->size, 0);
+    header->free = 1;
+    debug_info_remove(header);
+
+    // only the surviving header and, after a merge, the header behind it change; the block in front
+    // keeps its next pointer, so its control sum stays valid
+    unsigned long old_size = header->size;
+    int merged = 0;
+    if(header->prev && header->prev->free)
+    {
+        free_list_remove(arena, header->prev);
+        header = concat_memory_blocks(header->prev, header);
+        merged = 1;
+    }
+    if(header->next && header->next->free)
+    {
+        free_list_remove(arena, header->next);
+        header = concat_memory_blocks(header, header->next);
+        merged = 1;
+    }
+    if(header->next)
+        header->size = (uint8_t*)header->next - (uint8_t*)header - HEADER_FENCE_SIZE(0);
+    else
+        arena->last_block = header;
+
+    if(merged || header->size != old_size)     // the closing fence moved
+        draw_fences(header);
+    header->control_sum = calculate_control_size((uint8_t*)header);
+    if(merged && header->next)
+        header->next->control_sum = calculate_control_size((uint8_t*)header->next);
+    free_list_insert(arena, header);
+}
+
+void heap_free(void* memblock)
+{
+    if(!__atomic_load_n(&trace_file, __ATOMIC_ACQUIRE))
+    {
+        heap_free_untraced(memblock);
+        return;
+    }
+    trace_begin();
+    trace_write(trace_free, memblock, NULL, 0, 0);
+    heap_free_untraced(memblock);
+    trace_end();
+}
+
+void heap_free_untraced(void* memblock)
+{
+    if(!memblock || slab_free(memblock) || thread_cache_free(memblock))
+        return;
+    if(heap_validate_policy(1))
+        return;
+
+    struct arena* arena = arena_of(memblock);
+    if(!remote_frees_enabled)
+        arena_lock(arena);
+    else if(pthread_mutex_trylock(&arena->mutex))     // busy, leave the block to whoever holds the lock next
+    {
+        __atomic_fetch_add(&arena->stats.contentions, 1, __ATOMIC_RELAXED);
+        if(remote_free_push(arena, memblock))
+            return;
+        pthread_mutex_lock(&arena->mutex);
+    }
+    remote_free_drain_locked(arena);     // a block queued before must not be freed twice
+    if(get_pointer_type_locked(arena, memblock) == pointer_valid)
+    {
+        heap_free_locked(arena, memblock);
+        heap_auto_trim_locked(arena);
+    }
+    pthread_mutex_unlock(&arena->mutex);
+}
+
+void heap_set_remote_frees(int enabled)     // blocks already queued are still handed back with the next lock
+{
+    remote_frees_enabled = enabled != 0;
+}
+
+int remote_free_push(struct arena* arena, void* memblock)
+{
+    uint8_t* heap_end = (uint8_t*)arena->start + (arena == &arenas[0] ? arena->pages_allocated * PAGE_SIZE : ARENA_SIZE);
+    if((uint8_t*)memblock < (uint8_t*)arena->start + header_size + FENCE_SIZE || (uint8_t*)memblock + 2 * WORD_LEN + FENCE_SIZE > heap_end || !(IS_POINTER_DIVISIBLE_BY_WORD(memblock)))
+        return 0;
+
+    // the link overwrites the first word of the block before get_pointer_type checks it under the lock, so
+    // only a pointer whose header checksum and fences hold is queued; the second word marks the block as
+    // queued, so freeing it again cannot overwrite its link; blocks smaller than two words take the lock
+    mem_header* header = (mem_header*)((uint8_t*)memblock - FENCE_SIZE - header_size);
+    if(header->free || header->size < 2 * WORD_LEN || header->size > (size_t)(heap_end - (uint8_t*)memblock - FENCE_SIZE))
+        return 0;
+    if(calculate_control_size((const uint8_t*)header) != header->control_sum || !fences_intact(header))
+        return 0;
+    uint64_t* mark = (uint64_t*)memblock + 1;
+    uint64_t queued = (uintptr_t)memblock ^ REMOTE_FREE_MARK;
+    uint64_t data = __atomic_load_n(mark, __ATOMIC_RELAXED);
+    if(data == queued || !__atomic_compare_exchange_n(mark, &data, queued, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return 1;     // already queued, a double free is ignored like on the locked path
+
+    void* head = __atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED);
+    do
+        *(void**)memblock = head;
+    while(!__atomic_compare_exchange_n(&arena->remote_frees, &head, memblock, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return 1;
+}
+
+void remote_free_drain_locked(struct arena* arena)
+{
+    if(!__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED))
+        return;
+    void* memblock = __atomic_exchange_n(&arena->remote_frees, NULL, __ATOMIC_ACQUIRE);     // the whole stack at once, so no ABA
+    while(memblock && get_pointer_type_locked(arena, memblock) == pointer_valid)
+    {
+        void* next = *(void**)memblock;
+        ((uint64_t*)memblock)[1] = 0;     // the mark must not outlive the queue, the memory may become a new block
+        heap_free_locked(arena, memblock);
+        memblock = next;
+    }
+}
+
+void heap_auto_trim_locked(struct arena* arena)
+{
+    if(arena == &arenas[0])
+        debug_table_shrink_locked();
+    // a block went into a free tail, give memory back once enough of it piled up at the end of the heap;
+    // what heap_grow would reserve again stays, so one block allocated and freed in turn does not grow and trim the heap every time
+    if(arena == &arenas[0] && trim_threshold && !arena->is_empty && arena->last_block->free
+        && (uint8_t*)arena->start + arena->pages_allocated * PAGE_SIZE - (uint8_t*)arena->last_block >= (intptr_t)trim_threshold)
+    {
+        size_t reserve = arena->pages_allocated * growth_percent / 100 * PAGE_SIZE;
+        heap_trim_locked(arena, reserve > trim_pad ? reserve : trim_pad);
+    }
+}
+
+size_t heap_malloc_batch(size_t size, size_t count, void** out)     // all or nothing, returns count or 0
+{
+    if(!__atomic_load_n(&trace_file, __ATOMIC_ACQUIRE))
+        return heap_malloc_batch_untraced(size, count, out);
+    trace_begin();
+    size_t done = heap_malloc_batch_untraced(size, count, out);
+    for(size_t i = 0; i < done; ++i)     // recorded one by one, the replay has no batches
+        trace_write(trace_malloc, out[i], NULL, size, 0);
+    trace_end();
+    return done;
+}
+
+size_t heap_malloc_batch_untraced(size_t size, size_t count, void** out)
+{
+    if(!size || size > HEAP_MAX_REQUEST || !count || !out || heap_validate_policy(0))
+        return 0;
+
+    size_t done = 0;
+    struct arena* arena = arena_get(size);
+    arena_lock(arena);
+    remote_free_drain_locked(arena);
+    while(done < count)     // consecutive blocks from the free end of the heap come out as one contiguous run
+    {
+        out[done] = heap_malloc_locked(arena, size);
+        if(out[done])
+            ++done;
+        else if(arena != &arenas[0])     // thread arena is full, the rest comes from the main heap
+        {
+            pthread_mutex_unlock(&arena->mutex);
+            arena = &arenas[0];
+            arena_lock(arena);
+        }
+        else
+            break;
+    }
+    pthread_mutex_unlock(&arena->mutex);
+
+    if(done < count)
+    {
+        heap_free_batch(out, done);
+        return 0;
+    }
+    return count;
+}
+
+void heap_free_batch(void** ptrs, size_t count)     // NULL entries are skipped, like in heap_free
+{
+    if(!__atomic_load_n(&trace_file, __ATOMIC_ACQUIRE))
+    {
+        heap_free_batch_untraced(ptrs, count);
+        return;
+    }
+    trace_begin();
+    for(size_t i = 0; ptrs && i < count; ++i)
+    {
+        if(ptrs[i])
+            trace_write(trace_free, ptrs[i], NULL, 0, 0);
+    }
+    heap_free_batch_untraced(ptrs, count);
+    trace_end();
+}
+
+void heap_free_batch_untraced(void** ptrs, size_t count)
+{
+    if(!ptrs || !count || heap_validate_policy(1))
+        return;
+
+    for(size_t i = 0; i < count; ++i)     // slab objects first, slab_grow and slab_chunk_release take the main heap lock under slab_mutex
+    {
+        if(ptrs[i])
+            slab_free(ptrs[i]);
+    }
+
+    struct arena* arena = NULL;
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(!ptrs[i] || slab_of(ptrs[i]))
+            continue;
+        if(arena != arena_of(ptrs[i]))     // one lock for every run of pointers from the same arena
+        {
+            if(arena)
+            {
+                heap_auto_trim_locked(arena);
+                pthread_mutex_unlock(&arena->mutex);
+            }
+            arena = arena_of(ptrs[i]);
+            arena_lock(arena);
+            remote_free_drain_locked(arena);
+        }
+        if(get_pointer_type_locked(arena, ptrs[i]) == pointer_valid)
+            heap_free_locked(arena, ptrs[i]);
+    }
+    if(arena)
+    {
+        heap_auto_trim_locked(arena);
+        pthread_mutex_unlock(&arena->mutex);
+    }
+}
+
+int heap_trim(size_t pad)
+{
+    if(heap_validate_policy(1))
+        return 0;
+    arena_lock(&arenas[0]);
+    int trimmed = heap_trim_locked(&arenas[0], pad);
+    pthread_mutex_unlock(&arenas[0].mutex);
+    return trimmed;
+}
+
+int heap_trim_locked(struct arena* arena, size_t pad)
+{
+    if(arena != &arenas[0])     // thread arenas have a fixed size
+        return 0;
+    debug_table_shrink_locked();
+
+    mem_header* last = arena->is_empty ? NULL : arena->last_block;
+    mem_header* last_used = last && last->free ? last->prev : last;     // a free tail block is dropped with the pages
+    uint8_t* end = last_used ? (uint8_t*)last_used + HEADER_FENCE_SIZE(last_used->size) : (uint8_t*)arena->start;
+    unsigned long pages = ALIGN((size_t)(end - (uint8_t*)arena->start) + pad, PAGE_SIZE) / PAGE_SIZE;
+    if(pages < 1)
+        pages = 1;
+    if(pages >= arena->pages_allocated)
+        return 0;
+
+    if(last && last->free)
+    {
+        free_list_remove(arena, last);
+        block_index_remove(last);
+        if(last_used)
+        {
+            last_used->next = NULL;
+            last_used->control_sum = calculate_control_size((uint8_t*)last_used);
+            arena->last_block = last_used;
+        }
+        else
+        {
+            arena->first_block = NULL;
+            arena->last_block = NULL;
+            arena->is_empty = 1;
+        }
+    }
+    custom_sbrk(-(intptr_t)((arena->pages_allocated - pages) * PAGE_SIZE));
+    ++sbrk_calls;
+    arena->pages_allocated = pages;
+    return 1;
+}
+
+void heap_set_trim(size_t threshold, size_t pad)
+{
+    trim_threshold = threshold;
+    trim_pad = pad;
+}
+
+void heap_set_thread_cache(int enabled)
+{
+    if(!enabled)
+        heap_thread_cache_flush();
+    thread_cache_enabled = enabled != 0;
+}
+
+void heap_thread_cache_flush(void)
+{
+    thread_cache_flush(&thread_cache);
+}
+
+void thread_cache_flush(void* cache)     // also the destructor of thread_cache_key, runs on thread exit
+{
+    struct thread_cache* tc = (struct thread_cache*)cache;
+    if(arenas[0].start && tc->generation == heap_generation)
+    {
+        for(int bin = 0; bin < THREAD_CACHE_BINS; ++bin)
+        {
+            for(int i = 0; i < tc->counts[bin]; ++i)
+            {
+                struct arena* arena = arena_of(tc->bins[bin][i]);
+                arena_lock(arena);
+                heap_free_locked(arena, tc->bins[bin][i]);
+                pthread_mutex_unlock(&arena->mutex);
+            }
+        }
+    }
+    memset(tc->counts, 0, sizeof(tc->counts));
+}
+
+void thread_cache_key_create(void)
+{
+    pthread_key_create(&thread_cache_key, thread_cache_flush);
+}
+
+struct thread_cache* thread_cache_get(void)
+{
+    if(!thread_cache.registered)     // register the cache so it is handed back when the thread exits
+    {
+        pthread_once(&thread_cache_key_once, thread_cache_key_create);
+        pthread_setspecific(thread_cache_key, &thread_cache);
+        thread_cache.registered = 1;
+        thread_cache.generation = heap_generation;
+    }
+    if(thread_cache.generation != heap_generation)
+    {
+        memset(thread_cache.counts, 0, sizeof(thread_cache.counts));
+        thread_cache.generation = heap_generation;
+    }
+    return &thread_cache;
+}
+
+void* thread_cache_malloc(size_t size)
+{
+    if(!thread_cache_enabled || size > THREAD_CACHE_MAX_SIZE || !arenas[0].start)
+        return NULL;
+
+    struct thread_cache* cache = thread_cache_get();
+    int bin = (int)((size - 1) / WORD_LEN);
+    if(!cache->counts[bin])     // empty bin, refill a batch of blocks rounded up to the class size under one lock
+    {
+        if(heap_validate_policy(0))
+            return NULL;
+        struct arena* arena = arena_get(size);
+        arena_lock(arena);
+        remote_free_drain_locked(arena);
+        while(cache->counts[bin] < THREAD_CACHE_BATCH)
+        {
+            void* ptr = heap_malloc_locked(arena, (bin + 1) * WORD_LEN);
+            if(!ptr)
+                break;
+            cache->bins[bin][cache->counts[bin]++] = ptr;
+        }
+        pthread_mutex_unlock(&arena->mutex);
+        if(!cache->counts[bin])
+            return NULL;
+    }
+    return cache->bins[bin][--cache->counts[bin]];
+}
+
+int thread_cache_free(void* memblock)
+{
+    struct arena* arena = &arenas[0];     // thread arenas live inside the main heap
+    if(!thread_cache_enabled || !arena->start || arena->is_empty)
+        return 0;
+    uint8_t* heap_end = (uint8_t*)arena->start + arena->pages_allocated * PAGE_SIZE;
+    if((uint8_t*)memblock < (uint8_t*)arena->start + header_size + FENCE_SIZE || (uint8_t*)memblock + THREAD_CACHE_MAX_SIZE + FENCE_SIZE > heap_end || !(IS_POINTER_DIVISIBLE_BY_WORD(memblock)))
+        return 0;
+
+    // cheap checks only, like in remote_free_push; anything that does not look like a small used block goes
+    // the slow way through get_pointer_type, so do debug blocks, heap_free_locked drops their call site
+    mem_header* header = (mem_header*)((uint8_t*)memblock - FENCE_SIZE - header_size);
+    if(header->free || !header->size || header->size > THREAD_CACHE_MAX_SIZE || header->size % WORD_LEN || (header->flags & HEADER_DEBUG_INFO))
+        return 0;
+    if(calculate_control_size((const uint8_t*)header) != header->control_sum || !fences_intact(header))
+        return 0;
+
+    struct thread_cache* cache = thread_cache_get();
+    int bin = (int)(header->size / WORD_LEN) - 1;
+    for(int i = 0; i < cache->counts[bin]; ++i)
+    {
+        if(cache->bins[bin][i] == memblock)     // double free
+            return 1;
+    }
+    if(cache->counts[bin] == THREAD_CACHE_BIN_CAPACITY)     // full bin, hand the oldest batch back to the heap under one lock
+    {
+        for(int i = 0; i < THREAD_CACHE_BATCH; ++i)
+        {
+            arena = arena_of(cache->bins[bin][i]);
+            arena_lock(arena);
+            heap_free_locked(arena, cache->bins[bin][i]);
+            pthread_mutex_unlock(&arena->mutex);
+        }
+        memmove(cache->bins[bin], cache->bins[bin] + THREAD_CACHE_BATCH, (THREAD_CACHE_BIN_CAPACITY - THREAD_CACHE_BATCH) * sizeof(void*));
+        cache->counts[bin] -= THREAD_CACHE_BATCH;
+    }
+    cache->bins[bin][cache->counts[bin]++] = memblock;
+    return 1;
+}
+
+void heap_set_slabs(int enabled)     // objects already in slabs stay valid and can be freed after turning it off
+{
+    slabs_enabled = enabled != 0;
+}
+
+struct slab* slab_of(const void* pointer)
+{
+    void* start = arenas[0].start;
+    if(!start || (uint8_t*)pointer < (uint8_t*)start)
+        return NULL;
+    uintptr_t first_page = ALIGN((uintptr_t)start, PAGE_SIZE);
+    uintptr_t page = ((uintptr_t)pointer & ~(uintptr_t)(PAGE_SIZE - 1)) - first_page;
+    if((uintptr_t)pointer < first_page || page / PAGE_SIZE >= HEAP_INDEX_PAGES)
+        return NULL;
+    page /= PAGE_SIZE;
+    if(!(__atomic_load_n(&slab_page_map[page / 64], __ATOMIC_ACQUIRE) & (1UL << (page % 64))))
+        return NULL;
+    return (struct slab*)((uintptr_t)pointer & ~(uintptr_t)(PAGE_SIZE - 1));
+}
+
+struct slab* slab_chunk(struct slab* slab)     // first page of the chunk the slab was carved from
+{
+    return (struct slab*)((uint8_t*)slab - (size_t)slab->chunk_page * PAGE_SIZE);
+}
+
+void slab_unused_push(struct slab* slab)     // called with slab_mutex held
+{
+    slab->object_size = 0;
+    slab->prev = NULL;
+    slab->next = slab_unused;
+    if(slab_unused)
+        slab_unused->prev = slab;
+    slab_unused = slab;
+    ++slab_chunk(slab)->unused_pages;
+}
+
+void slab_unused_remove(struct slab* slab)     // called with slab_mutex held
+{
+    if(slab->prev)
+        slab->prev->next = slab->next;
+    else
+        slab_unused = slab->next;
+    if(slab->next)
+        slab->next->prev = slab->prev;
+    --slab_chunk(slab)->unused_pages;
+}
+
+void slab_chunk_release(struct slab* chunk)     // called with slab_mutex held, once no page of the chunk holds objects
+{
+    uintptr_t page = ((uintptr_t)chunk - ALIGN((uintptr_t)arenas[0].start, PAGE_SIZE)) / PAGE_SIZE;
+    for(int i = 0; i < SLAB_CHUNK_PAGES; ++i, ++page)
+    {
+        slab_unused_remove((struct slab*)((uint8_t*)chunk + i * PAGE_SIZE));
+        __atomic_fetch_and(&slab_page_map[page / 64], ~(1UL << (page % 64)), __ATOMIC_RELEASE);
+    }
+    struct arena* arena = &arenas[0];     // after slab_mutex, like in slab_grow
+    arena_lock(arena);
+    remote_free_drain_locked(arena);
+    heap_free_locked(arena, chunk);
+    heap_auto_trim_locked(arena);
+    pthread_mutex_unlock(&arena->mutex);
+}
+
+int slab_grow(void)     // called with slab_mutex held, so the chunk is not traced: trace_mutex comes before slab_mutex
+{
+    uint8_t* chunk = heap_alloc_untraced(SLAB_CHUNK_PAGES * PAGE_SIZE, PAGE_SIZE, 0, NULL);
+    if(!chunk)
+        return 0;
+    uintptr_t page = ((uintptr_t)chunk - ALIGN((uintptr_t)arenas[0].start, PAGE_SIZE)) / PAGE_SIZE;
+    if(page + SLAB_CHUNK_PAGES > HEAP_INDEX_PAGES)     // slab_of could not find it
+    {
+        heap_free_untraced(chunk);
+        return 0;
+    }
+    ((struct slab*)chunk)->unused_pages = 0;
+    for(int i = 0; i < SLAB_CHUNK_PAGES; ++i, ++page)
+    {
+        struct slab* slab = (struct slab*)(chunk + i * PAGE_SIZE);
+        slab->chunk_page = (unsigned short)i;
+        slab->used = 0;
+        slab_unused_push(slab);
+        __atomic_fetch_or(&slab_page_map[page / 64], 1UL << (page % 64), __ATOMIC_RELEASE);
+    }
+    return 1;
+}
+
+void* slab_malloc(size_t size)
+{
+    if(!slabs_enabled || size > SLAB_MAX_SIZE || !arenas[0].start)
+        return NULL;
+
+    int class = (int)((size - 1) / SLAB_GRANULE);
+    pthread_mutex_lock(&slab_mutex);
+    struct slab* slab = slab_partial[class];
+    if(!slab)     // take an unused page and lay out the objects of the class in it
+    {
+        if(!slab_unused && !slab_grow())
+        {
+            pthread_mutex_unlock(&slab_mutex);
+            return NULL;
+        }
+        slab = slab_unused;
+        slab_unused_remove(slab);
+        slab->object_size = (class + 1) * SLAB_GRANULE;
+        slab->capacity = (PAGE_SIZE - SLAB_HEADER_SIZE) / slab->object_size;
+        slab->used = 0;
+        for(int word = 0; word < 4; ++word)
+        {
+            int bits = slab->capacity - word * 64;
+            slab->used_map[word] = bits >= 64 ? 0 : bits <= 0 ? ~0ULL : ~0ULL << bits;
+        }
+        slab->prev = NULL;
+        slab->next = NULL;
+        slab_partial[class] = slab;
+    }
+
+    int word = 0;
+    while(!~slab->used_map[word])
+        ++word;
+    int bit = __builtin_ctzll(~slab->used_map[word]);
+    slab->used_map[word] |= 1ULL << bit;
+    if(++slab->used == slab->capacity)     // full slabs leave the list, heap_free puts them back
+    {
+        slab_partial[class] = slab->next;
+        if(slab->next)
+            slab->next->prev = NULL;
+    }
+    ++slab_objects[class];
+    pthread_mutex_unlock(&slab_mutex);
+    return (uint8_t*)slab + SLAB_HEADER_SIZE + (word * 64 + bit) * slab->object_size;
+}
+
+int slab_free(void* memblock)
+{
+    struct slab* slab = slab_of(memblock);
+    if(!slab)
+        return 0;
+
+    pthread_mutex_lock(&slab_mutex);
+    size_t offset = (uint8_t*)memblock - ((uint8_t*)slab + SLAB_HEADER_SIZE);
+    size_t object = slab->object_size ? offset / slab->object_size : 0;
+    // anything but the start of an allocated object is ignored, like invalid pointers of the block list
+    if(slab->object_size && (uint8_t*)memblock >= (uint8_t*)slab + SLAB_HEADER_SIZE && offset % slab->object_size == 0
+        && object < slab->capacity && (slab->used_map[object / 64] & (1ULL << (object % 64))))
+    {
+        int class = slab->object_size / SLAB_GRANULE - 1;
+        slab->used_map[object / 64] &= ~(1ULL << (object % 64));
+        --slab_objects[class];
+        if(slab->used-- == slab->capacity)     // was full, is back among the slabs with free objects
+        {
+            slab->prev = NULL;
+            slab->next = slab_partial[class];
+            if(slab->next)
+                slab->next->prev = slab;
+            slab_partial[class] = slab;
+        }
+        if(!slab->used)     // the page may serve another class now, or the whole chunk goes back to the heap
+        {
+            if(slab->prev)
+                slab->prev->next = slab->next;
+            else
+                slab_partial[class] = slab->next;
+            if(slab->next)
+                slab->next->prev = slab->prev;
+            slab_unused_push(slab);
+            if(slab_chunk(slab)->unused_pages == SLAB_CHUNK_PAGES)
+                slab_chunk_release(slab_chunk(slab));
+        }
+    }
+    pthread_mutex_unlock(&slab_mutex);
+    return 1;
+}
+
+enum pointer_type_t slab_pointer_type(struct slab* slab, const void* pointer)
+{
+    pthread_mutex_lock(&slab_mutex);
+    enum pointer_type_t type = pointer_unallocated;
+    size_t offset = (uint8_t*)pointer - ((uint8_t*)slab + SLAB_HEADER_SIZE);
+    if((uint8_t*)pointer < (uint8_t*)slab + SLAB_HEADER_SIZE)
+        type = pointer_control_block;
+    else if(slab->object_size && offset / slab->object_size < slab->capacity
+        && (slab->used_map[offset / slab->object_size / 64] & (1ULL << (offset / slab->object_size % 64))))
+        type = offset % slab->object_size ? pointer_inside_data_block : pointer_valid;
+    pthread_mutex_unlock(&slab_mutex);
+    return type;
+}
+
+void heap_set_arenas(int count)
+{
+    arenas_count = count < 1 ? 1 : count > ARENAS_MAX ? ARENAS_MAX : count;
+}
+
+struct arena* arena_get(size_t size)
+{
+    if(arenas_count == 1 || size > ARENA_MAX_REQUEST)
+        return &arenas[0];
+    if(thread_arena < 0 || thread_arena >= arenas_count)
+        thread_arena = (int)(__atomic_fetch_add(&arenas_next, 1, __ATOMIC_RELAXED) % arenas_count);
+
+    struct arena* arena = &arenas[thread_arena];
+    if(arena != &arenas[0] && !__atomic_load_n(&arena->start, __ATOMIC_ACQUIRE))     // pairs with the release store in arena_create
+        return arena_create(arena);
+    return arena;
+}
+
+struct arena* arena_create(struct arena* arena)
+{
+    arena_lock(&arenas[0]);
+    if(!arena->start)     // another thread of this arena may have been first
+    {
+        void* region = heap_malloc_locked(&arenas[0], ARENA_SIZE);
+        if(!region)
+        {
+            pthread_mutex_unlock(&arenas[0].mutex);
+            return &arenas[0];
+        }
+        arena->first_block = NULL;
+        arena->last_block = NULL;
+        arena->is_empty = 1;
+        arena->pages_allocated = ARENA_SIZE / PAGE_SIZE;
+        memset(arena->free_lists, 0, sizeof(arena->free_lists));
+        memset(arena->free_lists_tail, 0, sizeof(arena->free_lists_tail));
+        arena->free_lists_map = 0;
+        arena->free_tree = NULL;
+        arena->page_last = arena_page_last[arena - arenas];
+        arena->page_map = arena_page_map[arena - arenas];
+        arena->index_pages = ARENA_SIZE / PAGE_SIZE;
+        arena->rover = NULL;
+        arena->validate_cursor = NULL;
+        arena->remote_frees = NULL;
+        memset(&arena->stats, 0, sizeof(arena->stats));
+        memset(arena->page_last, 0, sizeof(arena_page_last[0]));
+        memset(arena->page_map, 0, sizeof(arena_page_map[0]));
+        pthread_mutex_init(&arena->mutex, NULL);
+        __atomic_store_n(&arena->start, region, __ATOMIC_RELEASE);     // arena_of may look at it without the lock
+    }
+    pthread_mutex_unlock(&arenas[0].mutex);
+    return arena;
+}
+
+struct arena* arena_of(const void* pointer)
+{
+    for(int i = 1; i < ARENAS_MAX; ++i)
+    {
+        void* start = __atomic_load_n(&arenas[i].start, __ATOMIC_ACQUIRE);
+        if(start && (uint8_t*)pointer >= (uint8_t*)start && (uint8_t*)pointer < (uint8_t*)start + ARENA_SIZE)
+            return &arenas[i];
+    }
+    return &arenas[0];
+}
+
+size_t heap_get_largest_used_block_size(void)
+{
+    if(!arenas[0].start || arenas[0].is_empty || heap_validate_policy(0))
+        return 0;
+
+    size_t max_size = 0;
+    for(int i = 0; i < ARENAS_MAX; ++i)
+    {
+        struct arena* arena = &arenas[i];
+        if(!__atomic_load_n(&arena->start, __ATOMIC_ACQUIRE))
+            continue;
+        arena_lock(arena);
+        mem_header* temp = arena->first_block;
+
+        while(temp)
+        {
+            // regions of thread arenas, slab chunks and the debug table are not user blocks, the first two are counted separately
+            if(temp->free == 0 && (i != 0 || (arena_of((uint8_t*)temp + header_size + FENCE_SIZE) == arena && !slab_of((uint8_t*)temp + header_size + FENCE_SIZE) && !debug_table_block(temp))))
+            {
+                if(max_size < temp->size)
+                    max_size = temp->size;
+            }
+            temp = temp->next;
+        }
+        pthread_mutex_unlock(&arena->mutex);
+    }
+    pthread_mutex_lock(&slab_mutex);
+    for(int class = 0; class < SLAB_CLASSES; ++class)     // slab objects count with the size of their class
+    {
+        if(slab_objects[class] && max_size < (size_t)(class + 1) * SLAB_GRANULE)
+            max_size = (class + 1) * SLAB_GRANULE;
+    }
+    pthread_mutex_unlock(&slab_mutex);
+
+    return max_size;
+}
+
+int heap_dump_map(const char* path)     // every block, thread arena region and slab page, for heap_map to analyse offline
+{
+    uint8_t* start = arenas[0].start;
+    if(!path || !start)
+        return -1;
+    FILE* file = fopen(path, "wb");
+    if(!file)
+        return -1;
+
+    struct heap_map_header header = {MAP_MAGIC, sizeof(struct heap_map_record), PAGE_SIZE, HEADER_FENCE_SIZE(0),
+        (uintptr_t)start, __atomic_load_n(&arenas[0].pages_allocated, __ATOMIC_RELAXED) * PAGE_SIZE};
+    int status = fwrite(&header, sizeof(header), 1, file) == 1 ? 0 : -1;
+    for(int i = 0; i < ARENAS_MAX && !status; ++i)
+    {
+        struct arena* arena = &arenas[i];
+        if(!__atomic_load_n(&arena->start, __ATOMIC_ACQUIRE))
+            continue;
+        pthread_mutex_lock(&arena->mutex);     // one arena at a time, the others keep allocating
+        for(mem_header* temp = arena->is_empty ? NULL : arena->first_block; temp && !status; temp = temp->next)
+        {
+            uint8_t* data = (uint8_t*)temp + header_size + FENCE_SIZE;
+            struct heap_map_record record = {(uint8_t*)temp - start, temp->size, temp->free ? map_free : map_used, (uint8_t)i, 0, 0};
+            const char* filename = NULL;
+            if(!temp->free && !i && slab_of(data))
+                record.kind = map_slab_chunk;
+            else if(!temp->free && !i && arena_of(data) != arena)
+                record.kind = map_arena;
+            else if(!temp->free && !i && debug_table_block(temp))
+                record.kind = map_debug_table;
+            else if(!temp->free)
+                debug_info_get(temp, &record.fileline, &filename);
+            record.filename_length = filename ? (uint16_t)strnlen(filename, UINT16_MAX) : 0;
+            if(fwrite(&record, sizeof(record), 1, file) != 1 || (record.filename_length && fwrite(filename, record.filename_length, 1, file) != 1))
+                status = -1;
+        }
+        pthread_mutex_unlock(&arena->mutex);
+    }
+
+    pthread_mutex_lock(&slab_mutex);     // after the arenas, slab_grow takes the lock of the main heap under it
+    uint8_t* first_page = (uint8_t*)ALIGN((uintptr_t)start, PAGE_SIZE);
+    for(unsigned long page = 0; page < HEAP_INDEX_PAGES && !status; ++page)
+    {
+        if(!(slab_page_map[page / 64] & (1UL << (page % 64))))
+            continue;
+        struct slab* slab = (struct slab*)(first_page + page * PAGE_SIZE);
+        struct heap_map_record record = {(uint8_t*)slab - start, (uint64_t)slab->used * slab->object_size, map_slab_page, 0, 0, slab->object_size};
+        if(fwrite(&record, sizeof(record), 1, file) != 1)
+            status = -1;
+    }
+    pthread_mutex_unlock(&slab_mutex);
+
+    if(fclose(file))
+        status = -1;
+    return status;
+}
+
+enum pointer_type_t get_pointer_type(const void* const pointer)
+{
+    if(!pointer)
+        return pointer_null;
+    if(heap_validate_policy(0))
+        return pointer_heap_corrupted;
+    struct slab* slab = slab_of(pointer);
+    if(slab)
+        return slab_pointer_type(slab, pointer);
+
+    struct arena* arena = arena_of(pointer);
+    arena_lock(arena);     // other threads may be splitting or merging blocks on the way
+    enum pointer_type_t type = get_pointer_type_locked(arena, pointer);
+    pthread_mutex_unlock(&arena->mutex);
+    return type;
+}
+
+enum pointer_type_t get_pointer_type_locked(struct arena* arena, const void* const pointer)
+{
+    intptr_t ptr_handle = (intptr_t)pointer;
+    if(ptr_handle < (intptr_t)arena->start || arena->is_empty)
+        return pointer_unallocated;
+    else if(ptr_handle < (intptr_t)((uint8_t*)arena->first_block + header_size))
+        return pointer_control_block;
+
+    mem_header* temp = block_index_find(arena, pointer);
+    if(!temp)
+        temp = arena->first_block;
+
+    while(temp->next && (intptr_t)temp->next <= ptr_handle)
+        temp = temp->next;
+    if(ptr_handle < (intptr_t)((uint8_t*)temp + header_size))
+        return pointer_control_block;
+    else if(ptr_handle < (intptr_t)((uint8_t*)temp + header_size + FENCE_SIZE) && temp->free == 0)
+        return pointer_inside_fences;
+    else if(ptr_handle < (intptr_t)((uint8_t*)temp + header_size + FENCE_SIZE) && temp->free == 1)
+        return pointer_unallocated;
+    else if(ptr_handle == (intptr_t)((uint8_t*)temp + header_size + FENCE_SIZE) && temp->free == 0)
+        return pointer_valid;
+    else if(ptr_handle == (intptr_t)((uint8_t*)temp + header_size + FENCE_SIZE))
+        return pointer_unallocated;
+    else if(ptr_handle < (intptr_t)((uint8_t*)temp + header_size + FENCE_SIZE + temp->size) && temp->free == 0)
+        return pointer_inside_data_block;
+    else if(ptr_handle < (intptr_t)((uint8_t*)temp + header_size + FENCE_SIZE + temp->size))
+        return pointer_unallocated;
+    else if(ptr_handle < (intptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size)) && temp->free == 0)
+        return pointer_inside_fences;
+    else if(ptr_handle >= (intptr_t)((uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) - FENCE_SIZE) && temp->free == 0 && ptr_handle < (intptr_t)temp->next)
+        return pointer_inside_fences;
+
+    return pointer_unallocated;
+}
+
+int heap_validate(void)
+{
+    // check if heap initialized
+    if(arenas[0].start == NULL)
+    {
+        return 2;              // return value 2 == HEAP_UNINITIALIZED
+    }
+    ///////////////////////////
+    for(int i = 0; i < ARENAS_MAX; ++i)
+    {
+        if(!__atomic_load_n(&arenas[i].start, __ATOMIC_ACQUIRE))
+            continue;
+        int status = arena_validate(&arenas[i]);
+        if(status)
+            return status;
+    }
+    return 0;       // return value 0 == HEAP_OK
+}
+
+int heap_validate_policy(int freeing)
+{
+    if(!arenas[0].start)
+        return 2;              // return value 2 == HEAP_UNINITIALIZED
+    switch(validation_policy)
+    {
+        case validation_full:
+            return heap_validate();
+        case validation_on_free:
+            return freeing ? heap_validate() : 0;
+        case validation_sampled:
+            return __atomic_fetch_add(&validation_calls, 1, __ATOMIC_RELAXED) % validation_interval ? 0 : heap_validate();
+        case validation_incremental:
+            return heap_validate_step(validation_budget);
+        default:
+            return 0;
+    }
+}
+
+void heap_set_validation(enum validation_policy_t policy, unsigned int interval)
+{
+    validation_policy = policy;
+    validation_interval = interval ? interval : 1;
+}
+
+void heap_set_validation_budget(unsigned long blocks)
+{
+    validation_budget = blocks ? blocks : 1;
+}
+
+// checks up to budget blocks from where the previous call stopped, arena after arena; it never waits:
+// a busy arena lock ends the slice and a step already running elsewhere makes this one a no-op, so it
+// can run before every operation or in a thread of its own
+int heap_validate_step(unsigned long budget)
+{
+    if(!arenas[0].start)
+        return 2;              // return value 2 == HEAP_UNINITIALIZED
+    if(pthread_mutex_trylock(&validation_mutex))
+        return 0;
+
+    int status = 0;
+    for(int visited = 0; budget && visited < ARENAS_MAX; ++visited)
+    {
+        struct arena* arena = &arenas[validation_arena];
+        if(__atomic_load_n(&arena->start, __ATOMIC_ACQUIRE))
+        {
+            if(pthread_mutex_trylock(&arena->mutex))
+                break;
+            status = arena_validate_slice(arena, &budget);
+            int finished = !arena->validate_cursor;
+            pthread_mutex_unlock(&arena->mutex);
+            if(status || !finished)
+                break;
+        }
+        if(++validation_arena == ARENAS_MAX)
+        {
+            validation_arena = 0;
+            __atomic_fetch_add(&validation_passes, 1, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&validation_mutex);
+    return status;
+}
+
+int arena_validate_slice(struct arena* arena, unsigned long* budget)     // called with the lock of the arena held
+{
+    mem_header* temp = arena->is_empty ? NULL : arena->validate_cursor ? arena->validate_cursor : arena->first_block;
+    int status = 0;
+    for(; temp && *budget && !status; --*budget)
+    {
+        status = block_validate(temp);
+        temp = temp->next;
+    }
+    arena->validate_cursor = status ? NULL : temp;     // a corrupted arena is checked from its start again
+    return status;
+}
+
+int block_validate(const mem_header* block)
+{
+    // check control sum //
+    if(calculate_control_size((const uint8_t*)block) != block->control_sum)
+        return 3;              // return value 3 == HEAP_CONTROL_STRUCTURES_CORRUPTED
+    // check fences integrity //
+    if(!fences_intact(block))
+        return 1;              // return value 1 == FENCES_CORRUPTED
+    return 0;
+}
+
+int arena_validate(struct arena* arena)
+{
+    arena_lock(arena);
+    if(arena->is_empty)
+    {
+        pthread_mutex_unlock(&arena->mutex);
+        return 0;              // return value 0 == HEAP_OK
+    }
+    int status = 0;
+    for(mem_header* i = arena->first_block; i && !status; i = i->next)
+        status = block_validate(i);
+
+    pthread_mutex_unlock(&arena->mutex);
+    return status;  // return value 0 == HEAP_OK
+}
+
+void* heap_malloc_aligned(size_t size)
+{
+    return heap_alloc(size, PAGE_SIZE, 0, NULL);
+}
+
+void* heap_memalign(size_t alignment, size_t size)
+{
+    if(!alignment || (alignment & (alignment - 1)))     // powers of two only
+        return NULL;
+    return heap_alloc(size, alignment, 0, NULL);
+}
+
+void* heap_aligned_alloc(size_t alignment, size_t size)
+{
+    return heap_memalign(alignment, size);
+}
+
+void* heap_memalign_locked(struct arena* arena, size_t alignment, size_t size)
+{
+    mem_header* temp = arena->is_empty ? NULL : free_list_find(arena, size, alignment);
+    if(temp)
+        free_list_remove(arena, temp);
+    else     // no free block fits, use the free end of the heap, together with the last block when that one is free
+    {
+        mem_header* last = arena->is_empty ? NULL : arena->last_block;
+        if(last && last->free)
+        {
+            free_list_remove(arena, last);
+            temp = last;
+        }
+        uint8_t* from = temp ? (uint8_t*)temp
+            : last ? (uint8_t*)ALIGN((uintptr_t)((uint8_t*)last + HEADER_FENCE_SIZE(last->size) + header_size + FENCE_SIZE), WORD_LEN) - header_size - FENCE_SIZE
+            : (uint8_t*)ALIGN((uintptr_t)((uint8_t*)arena->start + header_size + FENCE_SIZE), WORD_LEN) - header_size - FENCE_SIZE;
+        uint8_t* end = heap_aligned_header(from, alignment) + HEADER_FENCE_SIZE(size);
+        uint8_t* heap_end = (uint8_t*)arena->start + arena->pages_allocated * PAGE_SIZE;
+        if(end > heap_end && !heap_grow(arena, end - heap_end))
+        {
+            if(temp)
+                free_list_insert(arena, temp);
+            return NULL;
+        }
+
+        if(temp)     // the free last block stretches over the new space
+            temp->size = end - (uint8_t*)temp - HEADER_FENCE_SIZE(0);
+        else
+        {
+            temp = (mem_header*)from;
+            header_setup(temp, end - from - HEADER_FENCE_SIZE(0), last, NULL);
+            if(!last)
+            {
+                arena->first_block = temp;
+                arena->is_empty = 0;
+            }
+            arena->last_block = temp;
+        }
+    }
+
+    uint8_t* aligned = heap_aligned_header((uint8_t*)temp, alignment);
+    if(aligned != (uint8_t*)temp)     // the padding in front of the aligned block stays free
+    {
+        mem_header* block = (mem_header*)aligned;
+        header_setup(block, (uint8_t*)temp + HEADER_FENCE_SIZE(temp->size) - aligned - HEADER_FENCE_SIZE(0), temp, temp->next);
+        header_setup(temp, aligned - (uint8_t*)temp - HEADER_FENCE_SIZE(0), temp->prev, block);
+        temp->free = 1;
+        temp->control_sum = calculate_control_size((uint8_t*)temp);
+        free_list_insert(arena, temp);
+        if(!block->next)
+            arena->last_block = block;
+        temp = block;
+    }
+    header_setup(temp, size, temp->prev, temp->next);
+    stats_used_change(arena, 0, size);
+    block_split_locked(arena, temp);
+    return (uint8_t*)temp + header_size + FENCE_SIZE;
+}
+
+void* heap_calloc_aligned(size_t number, size_t size)
+{
+    return heap_alloc_zeroed(number, size, PAGE_SIZE, 0, NULL);
+}
+
+void* heap_realloc_aligned(void* memblock, size_t size)
+{
+    return heap_alloc_resize(memblock, size, PAGE_SIZE, 0, NULL);
+}
+
+void* heap_malloc_debug(size_t size, int fileline, const char* filename)
+{
+    return heap_alloc(size, WORD_LEN, fileline, filename);
+}
+
+void* heap_calloc_debug(size_t number, size_t size, int fileline, const char* filename)
+{
+    return heap_alloc_zeroed(number, size, WORD_LEN, fileline, filename);
+}
+
+void* heap_realloc_debug(void* memblock, size_t size, int fileline, const char* filename)
+{
+    return heap_alloc_resize(memblock, size, WORD_LEN, fileline, filename);
+}
+
+void* heap_malloc_aligned_debug(size_t size, int fileline, const char* filename)
+{
+    return heap_alloc(size, PAGE_SIZE, fileline, filename);
+}
+
+void* heap_calloc_aligned_debug(size_t number, size_t size, int fileline, const char* filename)
+{
+    return heap_alloc_zeroed(number, size, PAGE_SIZE, fileline, filename);
+}
+
+void* heap_realloc_aligned_debug(void* memblock, size_t size, int fileline, const char* filename)
+{
+    return heap_alloc_resize(memblock, size, PAGE_SIZE, fileline, filename);
+}
+
+int heap_trace_start(const char* path)     // records every public call until heap_trace_stop, to replay them later
+{
+    pthread_mutex_lock(&trace_mutex);
+    if(trace_file)
+    {
+        pthread_mutex_unlock(&trace_mutex);
+        return -1;
+    }
+    FILE* file = fopen(path, "wb");
+    struct heap_trace_header header = {TRACE_MAGIC, sizeof(struct heap_trace_record)};
+    if(!file || fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        if(file)
+            fclose(file);
+        pthread_mutex_unlock(&trace_mutex);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &trace_start_time);
+    trace_threads = 0;
+    ++trace_generation;
+    __atomic_store_n(&trace_file, file, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace_mutex);
+    return 0;
+}
+
+int heap_trace_stop(void)
+{
+    pthread_mutex_lock(&trace_mutex);
+    FILE* file = trace_file;
+    __atomic_store_n(&trace_file, NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace_mutex);
+    return file && fclose(file) == 0 ? 0 : -1;
+}
+
+// while a trace is recorded the traced calls run one at a time, so the records come out in the order
+// the calls took effect and an address never belongs to two live objects at once
+void trace_begin(void)
+{
+    if(!trace_nesting++)
+        pthread_mutex_lock(&trace_mutex);
+}
+
+void trace_write(enum heap_trace_op_t op, const void* object, const void* previous, size_t size, size_t alignment)
+{
+    if(trace_nesting != 1 || !trace_file)
+        return;
+    if(trace_thread_generation != trace_generation)     // first record of the thread in this trace
+    {
+        trace_thread = ++trace_threads;
+        trace_thread_generation = trace_generation;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct heap_trace_record record = {
+        .timestamp = (uint64_t)(now.tv_sec - trace_start_time.tv_sec) * 1000000000u + (uint64_t)now.tv_nsec - (uint64_t)trace_start_time.tv_nsec,
+        .object = (uintptr_t)object,
+        .previous = (uintptr_t)previous,
+        .size = size,
+        .op = (uint8_t)op,
+        .alignment_log2 = alignment > WORD_LEN ? (uint8_t)__builtin_ctzl(alignment) : 0,
+        .thread = trace_thread
+    };
+    fwrite(&record, sizeof(record), 1, trace_file);
+}
+
+void trace_end(void)
+{
+    if(!--trace_nesting)
+        pthread_mutex_unlock(&trace_mutex);
+}
@@ -1,65 +1,384 @@
-#ifndef HEAP_H
-#define HEAP_H
-
-#include "custom_unistd.h"
-#include <stdio.h>
-#include <stdint.h>
-#include <string.h>
-#include <pthread.h>
-
-struct my_header{
-    struct my_header* next;
-    struct my_header* prev;
-    unsigned long size;
-    uint8_t free;
-    int fileline;
-    const char* filename;
-    size_t control_sum;
-}__attribute__((__packed__));
-typedef struct my_header mem_header;
-
-#define PAGE_SIZE 4096
-#define FENCE_SIZE 4
-#define WORD_LEN sizeof(void*)
-#define HEADER_FENCE_SIZE(size) (sizeof(mem_header) + 2 * FENCE_SIZE + (size))
-#define CONTROL_SIZE sizeof(mem_header) - sizeof(size_t)
-#define IS_POINTER_DIVISIBLE_BY_WORD(ptr) ((intptr_t)(ptr) & (intptr_t)(WORD_LEN - 1)) == 0
-#define IS_POINTER_DIVISIBLE_BY_4096(ptr) ((intptr_t)(ptr) & (intptr_t)(PAGE_SIZE - 1)) == 0
-#define ALIGN(x,a) (((x)/(a)+((x)%(a) != 0))*(a))
-
-enum pointer_type_t
-{
-    pointer_null,
-    pointer_heap_corrupted,
-    pointer_control_block,
-    pointer_inside_fences,
-    pointer_inside_data_block,
-    pointer_unallocated,
-    pointer_valid
-};
-
-void draw_fences(mem_header* address);
-size_t calculate_control_size(uint8_t* ptr);
-void header_setup(mem_header* header, unsigned long size, mem_header* prev, mem_header* next);
-void header_setup_debug(mem_header* header, unsigned long size, mem_header* prev, mem_header* next, int fileline, const char* filename);
-int heap_setup(void);
-void heap_clean(void);
-void* heap_malloc(size_t size);
-void* heap_calloc(size_t number, size_t size);
-void* heap_realloc(void* memblock, size_t size);
-mem_header* concat_memory_blocks(mem_header* p1, mem_header* p2);
-void  heap_free(void* memblock);
-size_t heap_get_largest_used_block_size(void);
-enum pointer_type_t get_pointer_type(const void* const pointer);
-int heap_validate(void);
-void* heap_malloc_aligned(size_t size);
-void* heap_calloc_aligned(size_t number, size_t size);
-void* heap_realloc_aligned(void* memblock, size_t size);
-void* heap_malloc_debug(size_t count, int fileline, const char* filename);
-void* heap_calloc_debug(size_t number, size_t size, int fileline, const char* filename);
-void* heap_realloc_debug(void* memblock, size_t size, int fileline, const char* filename);
-void* heap_malloc_aligned_debug(size_t count, int fileline, const char* filename);
-void* heap_calloc_aligned_debug(size_t number, size_t size, int fileline, const char* filename);
-void* heap_realloc_aligned_debug(void* memblock, size_t size, int fileline, const char* filename);
-
-#endif //HEAP_H
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "custom_unistd.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+// naturally aligned, the control sum covers every byte in front of it; fileline and filename of blocks
+// from the *_debug functions are kept aside in debug_table, release blocks do not carry them
+struct my_header{
+    struct my_header* next;
+    struct my_header* prev;
+    unsigned long size;
+    uint8_t free;
+    uint8_t flags;
+    uint8_t reserved[2];
+    uint32_t control_sum;
+};
+typedef struct my_header mem_header;
+
+struct debug_info{
+    const mem_header* header;       // NULL for an empty slot
+    int fileline;
+    const char* filename;
+};
+
+struct free_links{
+    mem_header* next_free;
+    mem_header* prev_free;
+};
+
+// free blocks of LARGE_OBJECT_THRESHOLD and more sit in a treap ordered by size, then address, instead of
+// a free list; the node takes the place of the links, the priority is a hash of the address
+struct free_tree_node{
+    mem_header* left;
+    mem_header* right;
+};
+
+#define PAGE_SIZE 4096
+#define FENCE_SIZE 8                        // with the 32 byte header keeps headers of word aligned blocks word aligned
+#define FENCE_LEFT 0x6666666666666666ULL    // 'f' in every byte, a fence is compared as one word
+#define FENCE_RIGHT 0x4646464646464646ULL   // 'F'
+_Static_assert(FENCE_SIZE == sizeof(uint64_t), "fences are compared as one word");
+#define WORD_LEN sizeof(void*)
+#define HEADER_FENCE_SIZE(size) (sizeof(mem_header) + 2 * FENCE_SIZE + (size))
+#define CONTROL_SIZE offsetof(mem_header, control_sum)
+#define IS_POINTER_DIVISIBLE_BY_WORD(ptr) ((intptr_t)(ptr) & (intptr_t)(WORD_LEN - 1)) == 0
+#define IS_POINTER_DIVISIBLE_BY_4096(ptr) ((intptr_t)(ptr) & (intptr_t)(PAGE_SIZE - 1)) == 0
+#define ALIGN(x,a) (((x)/(a)+((x)%(a) != 0))*(a))
+#define HEAP_MAX_REQUEST ((size_t)INTPTR_MAX / 4) // bigger sizes and alignments are refused, so headers, fences and padding added to them cannot wrap
+#define FREE_LISTS_COUNT 32
+#define FREE_LIST_MIN_SIZE sizeof(struct free_links)
+#define LARGE_OBJECT_THRESHOLD (64 * 1024)  // free blocks from this size up are kept for large requests only, in a size ordered tree
+#define FREE_LINKS(header) ((struct free_links*)((uint8_t*)(header) + sizeof(mem_header) + FENCE_SIZE))
+#define FREE_TREE_NODE(header) ((struct free_tree_node*)((uint8_t*)(header) + sizeof(mem_header) + FENCE_SIZE))
+#define THREAD_CACHE_BINS 16                // exact size classes WORD_LEN, 2 * WORD_LEN, ..., THREAD_CACHE_MAX_SIZE
+#define THREAD_CACHE_MAX_SIZE (THREAD_CACHE_BINS * WORD_LEN)
+#define THREAD_CACHE_BIN_CAPACITY 8
+#define THREAD_CACHE_BATCH 4                // blocks moved between the cache and the heap under one lock
+#define DEBUG_TABLE_SIZE 4096               // initial slots of debug_table, power of two; it doubles inside the main heap when 3/4 full
+#define HEADER_DEBUG_INFO 0x01              // flags bit, debug_table holds fileline and filename of the block
+#define SLAB_CLASSES 16                     // object sizes SLAB_GRANULE, 2 * SLAB_GRANULE, ..., SLAB_MAX_SIZE
+#define SLAB_GRANULE 16
+#define SLAB_MAX_SIZE (SLAB_CLASSES * SLAB_GRANULE)
+#define SLAB_CHUNK_PAGES 16                 // pages carved from the main heap at once for new slabs
+#define SLAB_HEADER_SIZE ALIGN(sizeof(struct slab), SLAB_GRANULE)
+#define HEAP_GROWTH_MIN_PAGES 16           // the heap grows by at least this many pages at once
+#define HEAP_GROWTH_PERCENT 50              // and by at least this part of its current size
+#define HEAP_TRIM_THRESHOLD (32 * PAGE_SIZE) // heap_free gives the end of the heap back once this much of it is free, 0 turns it off
+#define HEAP_TRIM_PAD (16 * PAGE_SIZE)      // kept after the last used block when trimming
+#define HEAP_INDEX_PAGES 16384             // pages of the main heap covered by the block index, the rest is walked
+#define ARENAS_MAX 8
+#define ARENA_SIZE (64 * PAGE_SIZE)         // region carved from the main heap for every thread arena
+#define ARENA_MAX_REQUEST (ARENA_SIZE / 16) // bigger requests always go to the main heap
+#define REMOTE_FREE_MARK 0x5152454d4f544551ULL // xor the block address, second word of a block in a remote free queue
+
+// counters behind heap_get_stats, changed together with the free lists and the used blocks under the lock
+struct arena_stats{
+    unsigned long used_bytes;
+    unsigned long used_blocks;
+    unsigned long free_bytes;
+    unsigned long free_blocks;
+    unsigned long used_by_class[FREE_LISTS_COUNT];  // same power of two classes as the free lists
+    unsigned long free_by_class[FREE_LISTS_COUNT];
+    unsigned long contentions;                      // lock requests that found the lock taken, counted atomically
+};
+
+// arenas[0] is the main heap grown with custom_sbrk, the others are fixed regions carved out of it
+// as single used blocks, each with its own block list and lock
+struct arena{
+    void* start;
+    mem_header* first_block;
+    mem_header* last_block;
+    uint8_t is_empty;
+    unsigned long pages_allocated;
+    mem_header* free_lists[FREE_LISTS_COUNT];       // free blocks segregated by size class (power of two), oldest first
+    mem_header* free_lists_tail[FREE_LISTS_COUNT];
+    unsigned long free_lists_map;                   // bit i set <=> free_lists[i] is not empty
+    mem_header* free_tree;                          // free blocks from LARGE_OBJECT_THRESHOLD up
+    mem_header** page_last;                         // last block header starting in every page, in address order
+    unsigned long* page_map;                        // bit p set <=> page_last[p] is not NULL
+    unsigned long index_pages;
+    mem_header* rover;                              // where the last next fit search stopped
+    mem_header* validate_cursor;                    // next block for heap_validate_step, NULL for the first one
+    void* remote_frees;                             // blocks freed while the lock was busy, linked through their first word
+    struct arena_stats stats;
+    pthread_mutex_t mutex;
+};
+
+// blocks held in a thread cache keep their used headers, so heap_validate and get_pointer_type
+// see them as allocated until they are flushed back to the heap
+struct thread_cache{
+    void* bins[THREAD_CACHE_BINS][THREAD_CACHE_BIN_CAPACITY];
+    int counts[THREAD_CACHE_BINS];
+    unsigned long generation;
+    uint8_t registered;
+};
+
+// one page of equally sized objects without headers or fences, the page itself is a part of a used
+// block of the main heap, so heap_validate checks the fences around whole chunks of slabs only
+struct slab{
+    struct slab* next;              // next slab of the class with a free object, or next unused slab
+    struct slab* prev;
+    uint64_t used_map[4];           // bit i set <=> object i is allocated, bits past capacity are always set
+    unsigned short object_size;     // 0 for an unused slab
+    unsigned short capacity;
+    unsigned short used;
+    unsigned short chunk_page;      // index of the page in its slab chunk
+    unsigned short unused_pages;    // in the first page of a chunk only, the chunk goes back to the heap once all are unused
+};
+
+enum validation_policy_t
+{
+    validation_off,         // only the check whether the heap is initialised
+    validation_sampled,     // full heap_validate on every validation_interval-th call
+    validation_on_free,     // full heap_validate before heap_free and heap_realloc only
+    validation_full,        // full heap_validate before every operation
+    validation_incremental  // heap_validate_step of validation_budget blocks before every operation
+};
+
+// release builds skip the walk over all blocks, debug builds keep the strict mode
+#if !defined(HEAP_VALIDATION_DEFAULT)
+#if defined(NDEBUG)
+#define HEAP_VALIDATION_DEFAULT validation_off
+#else
+#define HEAP_VALIDATION_DEFAULT validation_full
+#endif
+#endif
+#define HEAP_VALIDATION_INTERVAL 64
+#define HEAP_VALIDATION_BUDGET 64           // blocks one heap_validate_step checks under an arena lock
+
+enum placement_policy_t
+{
+    placement_good_fit,     // first fit inside the smallest size class with a fitting block
+    placement_best_fit,     // smallest fitting block
+    placement_first_fit,    // fitting block at the lowest address
+    placement_next_fit      // first fitting block after the one found last time
+};
+
+// everything heap_setup_ex sets up at once, the heap_set_* functions change single fields later
+struct heap_config{
+    enum placement_policy_t placement;
+    enum validation_policy_t validation;
+    unsigned int validation_interval;
+    unsigned long validation_budget;
+    unsigned long growth_min_pages;
+    unsigned long growth_percent;
+    size_t trim_threshold;
+    size_t trim_pad;
+    int thread_cache;
+    int arenas;
+    int slabs;
+    int remote_frees;
+};
+
+// snapshot of all arenas; slab chunks and blocks held in thread caches or remote free queues count as used
+struct heap_stats{
+    size_t in_use;                                  // bytes in used blocks, without headers and fences
+    size_t free;                                    // bytes in free blocks, the unused end of the heap not included
+    size_t footprint;                               // bytes taken with custom_sbrk
+    size_t peak_footprint;
+    unsigned long used_blocks;
+    unsigned long free_blocks;
+    unsigned long used_by_class[FREE_LISTS_COUNT];  // class i holds sizes from 2^i up to 2^(i+1) - 1
+    unsigned long free_by_class[FREE_LISTS_COUNT];
+    unsigned long sbrk_calls;
+    unsigned long lock_contentions;
+    unsigned long validation_passes;                // rounds heap_validate_step finished over all arenas
+    double fragmentation;                           // 1 - largest free block / all free bytes
+};
+
+// trace files hold a heap_trace_header and then one heap_trace_record per call, in the host byte order
+#define TRACE_MAGIC "HTR"                   // with the terminating zero, 4 bytes
+
+enum heap_trace_op_t
+{
+    trace_malloc,
+    trace_calloc,           // size is number * size
+    trace_realloc,          // previous is the block passed in, object the one returned
+    trace_free,
+    trace_memalign
+};
+
+struct heap_trace_header{
+    char magic[4];
+    uint32_t record_size;
+};
+
+struct heap_trace_record{
+    uint64_t timestamp;     // nanoseconds since heap_trace_start
+    uint64_t object;        // address of the block, which identifies it while it is allocated; 0 for NULL
+    uint64_t previous;
+    uint64_t size;
+    uint8_t op;
+    uint8_t alignment_log2; // 0 for word alignment
+    uint16_t thread;        // threads are numbered from 1 in the order of their first record
+    uint32_t reserved;      // 0, makes the 40 byte size explicit, so no padding bytes reach the file
+};
+_Static_assert(sizeof(struct heap_trace_record) == 40, "trace files hold records without padding");
+
+// heap_dump_map files hold a heap_map_header and then one heap_map_record per block, in the host byte order;
+// records come in list order arena by arena, slab pages last, and a record with filename_length
+// is followed by that many bytes of the name
+#define MAP_MAGIC "HMP"                     // with the terminating zero, 4 bytes
+
+enum heap_map_kind_t
+{
+    map_used,
+    map_free,
+    map_arena,              // region of a thread arena, its blocks come with their own records
+    map_slab_chunk,         // pages of slabs, each comes with a map_slab_page record
+    map_slab_page,          // size is the bytes of allocated objects, fileline the object size, 0 if unused
+    map_debug_table         // fileline and filename of debug blocks, once they outgrew the static table
+};
+
+struct heap_map_header{
+    char magic[4];
+    uint32_t record_size;
+    uint32_t page_size;
+    uint32_t block_overhead;    // header and fences of every block
+    uint64_t heap_start;        // address the offsets are counted from
+    uint64_t footprint;         // bytes taken with custom_sbrk when the dump started
+};
+
+struct heap_map_record{
+    uint64_t offset;            // of the header, or of the page for slab pages
+    uint64_t size;
+    uint8_t kind;
+    uint8_t arena;
+    uint16_t filename_length;
+    int32_t fileline;           // 0 for blocks without debug info
+};
+
+enum pointer_type_t
+{
+    pointer_null,
+    pointer_heap_corrupted,
+    pointer_control_block,
+    pointer_inside_fences,
+    pointer_inside_data_block,
+    pointer_unallocated,
+    pointer_valid
+};
+
+void draw_fences(mem_header* address);
+int fences_intact(const mem_header* address);
+uint32_t calculate_control_size(const uint8_t* ptr);
+void header_setup(mem_header* header, unsigned long size, mem_header* prev, mem_header* next);
+void header_resize(mem_header* header, unsigned long size, mem_header* next);
+int free_list_index(unsigned long size);
+void free_list_insert(struct arena* arena, mem_header* block);
+void free_list_remove(struct arena* arena, mem_header* block);
+int free_tree_less(const mem_header* block, unsigned long size, const void* address);
+unsigned long free_tree_priority(const mem_header* block);
+mem_header* free_tree_insert(mem_header* root, mem_header* block);
+mem_header* free_tree_merge(mem_header* left, mem_header* right);
+mem_header* free_tree_remove(mem_header* root, mem_header* block);
+mem_header* free_tree_lower_bound(mem_header* root, unsigned long size, const void* address);
+int free_list_fits(mem_header* block, size_t required, size_t alignment);
+uint8_t* heap_aligned_header(uint8_t* from, size_t alignment);
+mem_header* free_list_find(struct arena* arena, size_t size, size_t alignment);
+mem_header* free_list_find_small(struct arena* arena, size_t required, size_t alignment);
+mem_header* large_object_find(struct arena* arena, size_t size);
+unsigned long debug_table_slot(const mem_header* header);
+int debug_table_resize_locked(unsigned long capacity);
+int debug_table_reserve_locked(void);
+void debug_table_shrink_locked(void);
+int debug_table_block(const mem_header* header);
+void debug_info_set(mem_header* header, int fileline, const char* filename);
+void debug_info_remove(mem_header* header);
+int heap_get_debug_info(const void* memblock, int* fileline, const char** filename);
+int debug_info_get(const mem_header* header, int* fileline, const char** filename);
+void block_index_insert(mem_header* header);
+void block_index_remove(mem_header* header);
+mem_header* block_index_find(struct arena* arena, const void* pointer);
+unsigned long heap_grow(struct arena* arena, unsigned long needed);
+void heap_set_growth(unsigned long min_pages, unsigned long percent);
+int heap_setup(void);
+int heap_setup_ex(const struct heap_config* config);
+void heap_get_default_config(struct heap_config* config);
+void heap_set_placement(enum placement_policy_t policy);
+double heap_get_fragmentation(void);
+int heap_get_stats(struct heap_stats* stats);
+void stats_used_change(struct arena* arena, unsigned long old_size, unsigned long new_size);
+void arena_lock(struct arena* arena);
+void heap_clean(void);
+void* heap_malloc_locked(struct arena* arena, size_t size);
+void* heap_malloc(size_t size);
+void* heap_calloc(size_t number, size_t size);
+void* heap_realloc(void* memblock, size_t size);
+void* heap_realloc_locked(struct arena* arena, mem_header* temp, size_t size, size_t alignment);
+void block_split_locked(struct arena* arena, mem_header* block);
+void* heap_realloc_move(void* memblock, void* new_block_location);
+mem_header* concat_memory_blocks(mem_header* p1, mem_header* p2);
+void heap_free_locked(struct arena* arena, void* memblock);
+void heap_free_untraced(void* memblock);
+void heap_set_remote_frees(int enabled);
+int remote_free_push(struct arena* arena, void* memblock);
+void remote_free_drain_locked(struct arena* arena);
+void  heap_free(void* memblock);
+void heap_auto_trim_locked(struct arena* arena);
+size_t heap_malloc_batch(size_t size, size_t count, void** out);
+size_t heap_malloc_batch_untraced(size_t size, size_t count, void** out);
+void heap_free_batch(void** ptrs, size_t count);
+void heap_free_batch_untraced(void** ptrs, size_t count);
+int heap_trim(size_t pad);
+int heap_trim_locked(struct arena* arena, size_t pad);
+void heap_set_trim(size_t threshold, size_t pad);
+void heap_set_thread_cache(int enabled);
+void heap_thread_cache_flush(void);
+void thread_cache_flush(void* cache);
+void thread_cache_key_create(void);
+struct thread_cache* thread_cache_get(void);
+void* thread_cache_malloc(size_t size);
+int thread_cache_free(void* memblock);
+void heap_set_slabs(int enabled);
+struct slab* slab_of(const void* pointer);
+struct slab* slab_chunk(struct slab* slab);
+void slab_unused_push(struct slab* slab);
+void slab_unused_remove(struct slab* slab);
+void slab_chunk_release(struct slab* chunk);
+int slab_grow(void);
+void* slab_malloc(size_t size);
+int slab_free(void* memblock);
+enum pointer_type_t slab_pointer_type(struct slab* slab, const void* pointer);
+void heap_set_arenas(int count);
+struct arena* arena_get(size_t size);
+struct arena* arena_create(struct arena* arena);
+struct arena* arena_of(const void* pointer);
+int arena_validate(struct arena* arena);
+int arena_validate_slice(struct arena* arena, unsigned long* budget);
+int block_validate(const mem_header* block);
+size_t heap_get_largest_used_block_size(void);
+int heap_dump_map(const char* path);
+enum pointer_type_t get_pointer_type(const void* const pointer);
+enum pointer_type_t get_pointer_type_locked(struct arena* arena, const void* const pointer);
+int heap_validate(void);
+int heap_validate_policy(int freeing);
+void heap_set_validation(enum validation_policy_t policy, unsigned int interval);
+void heap_set_validation_budget(unsigned long blocks);
+int heap_validate_step(unsigned long budget);
+void* heap_malloc_aligned(size_t size);
+void* heap_memalign(size_t alignment, size_t size);
+void* heap_aligned_alloc(size_t alignment, size_t size);
+void* heap_memalign_locked(struct arena* arena, size_t alignment, size_t size);
+void* heap_calloc_aligned(size_t number, size_t size);
+void* heap_realloc_aligned(void* memblock, size_t size);
+void* heap_malloc_debug(size_t count, int fileline, const char* filename);
+void* heap_calloc_debug(size_t number, size_t size, int fileline, const char* filename);
+void* heap_realloc_debug(void* memblock, size_t size, int fileline, const char* filename);
+void* heap_malloc_aligned_debug(size_t count, int fileline, const char* filename);
+void* heap_calloc_aligned_debug(size_t number, size_t size, int fileline, const char* filename);
+void* heap_realloc_aligned_debug(void* memblock, size_t size, int fileline, const char* filename);
+int heap_trace_start(const char* path);
+int heap_trace_stop(void);
+void trace_begin(void);
+void trace_write(enum heap_trace_op_t op, const void* object, const void* previous, size_t size, size_t alignment);
+void trace_end(void);
+
+#endif //HEAP_H
@@ -0,0 +1,258 @@
+#include "heap.h"
+#include <stdlib.h>
+
+// analyses a file written by heap_dump_map: fragmentation, free extents, occupancy of pages and the
+// places that allocated the used blocks
+// usage: heap_map [-l] [-s sites] map_file
+//   -l  lists every record as well
+//   -s  debug call sites shown, the ones holding the most bytes first (default 10)
+
+#define MAP_OCCUPANCY_BUCKETS 5         // empty, up to 1/4, 1/2, 3/4 and the whole page used
+
+struct map_block{
+    struct heap_map_record record;
+    char* filename;                     // NULL without debug info
+};
+
+struct map_site{
+    const char* filename;
+    int fileline;
+    unsigned long blocks;
+    uint64_t bytes;
+};
+
+const char* map_kind_names[] = {"used", "free", "arena", "slabs", "slab page", "debug tab"};
+
+int map_site_by_place(const void* a, const void* b)
+{
+    const struct map_site* left = a;
+    const struct map_site* right = b;
+    int order = strcmp(left->filename, right->filename);
+    return order ? order : (left->fileline > right->fileline) - (left->fileline < right->fileline);
+}
+
+int map_site_by_bytes(const void* a, const void* b)
+{
+    const struct map_site* left = a;
+    const struct map_site* right = b;
+    return (left->bytes < right->bytes) - (left->bytes > right->bytes);
+}
+
+void map_occupy(uint32_t* pages, uint64_t page_count, uint64_t address, uint64_t size, uint32_t page_size)     // address counted from the first page
+{
+    while(size && address / page_size < page_count)
+    {
+        uint64_t part = page_size - address % page_size;
+        part = part < size ? part : size;
+        pages[address / page_size] += (uint32_t)part;
+        address += part;
+        size -= part;
+    }
+}
+
+void map_sites(const struct map_block* blocks, size_t count, int shown)
+{
+    struct map_site* sites = malloc((count ? count : 1) * sizeof(*sites));
+    size_t sites_count = 0;
+    for(size_t i = 0; sites && i < count; ++i)
+    {
+        if(blocks[i].record.kind == map_used && blocks[i].filename)
+            sites[sites_count++] = (struct map_site){blocks[i].filename, blocks[i].record.fileline, 1, blocks[i].record.size};
+    }
+    if(!sites || !sites_count)
+    {
+        printf("no blocks with debug info\n");
+        free(sites);
+        return;
+    }
+
+    qsort(sites, sites_count, sizeof(*sites), map_site_by_place);
+    size_t merged = 0;
+    for(size_t i = 1; i < sites_count; ++i)
+    {
+        if(!map_site_by_place(&sites[merged], &sites[i]))
+        {
+            sites[merged].blocks += sites[i].blocks;
+            sites[merged].bytes += sites[i].bytes;
+        }
+        else
+            sites[++merged] = sites[i];
+    }
+    sites_count = merged + 1;
+    qsort(sites, sites_count, sizeof(*sites), map_site_by_bytes);
+
+    printf("%12s %10s  %s\n", "bytes", "blocks", "site");
+    for(size_t i = 0; i < sites_count && (int)i < shown; ++i)
+        printf("%12llu %10lu  %s:%d\n", (unsigned long long)sites[i].bytes, sites[i].blocks, sites[i].filename, sites[i].fileline);
+    free(sites);
+}
+
+int map_analyse(const struct heap_map_header* header, const struct map_block* blocks, size_t count, int list, int shown)
+{
+    uint64_t first_page = header->heap_start / header->page_size * header->page_size;
+    uint64_t end = 0, free_bytes = 0, largest_free = 0, used_bytes = 0, slab_bytes = 0, overhead = 0;
+    unsigned long kinds[map_debug_table + 1] = {0};
+    const struct map_block* last = NULL;     // of the main heap
+    for(size_t i = 0; i < count; ++i)
+    {
+        const struct heap_map_record* record = &blocks[i].record;
+        if(record->kind > map_debug_table)
+            continue;
+        kinds[record->kind]++;
+        if(record->kind == map_slab_page)
+        {
+            slab_bytes += record->size;
+            continue;
+        }
+        overhead += header->block_overhead;
+        if(record->kind == map_used)
+            used_bytes += record->size;
+        else if(record->kind == map_free)
+        {
+            free_bytes += record->size;
+            largest_free = record->size > largest_free ? record->size : largest_free;
+        }
+        if(!record->arena && record->offset + header->block_overhead + record->size > end)
+        {
+            end = record->offset + header->block_overhead + record->size;
+            last = &blocks[i];
+        }
+    }
+    uint64_t footprint = header->footprint > end ? header->footprint : end;     // the heap may have grown during the dump
+    uint64_t tail = footprint - end;
+
+    // bytes of user data in every page, free blocks, headers and fences count as empty
+    uint64_t page_count = (header->heap_start - first_page + footprint + header->page_size - 1) / header->page_size;
+    uint32_t* pages = calloc(page_count ? page_count : 1, sizeof(uint32_t));
+    if(!pages)
+    {
+        printf("out of memory\n");
+        return -1;
+    }
+    uint64_t last_used_page = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        const struct heap_map_record* record = &blocks[i].record;
+        uint64_t address = header->heap_start - first_page + record->offset;
+        if(record->kind == map_used)
+            address += header->block_overhead - FENCE_SIZE;
+        else if(record->kind != map_slab_page)
+            continue;
+        map_occupy(pages, page_count, address, record->size, header->page_size);
+        if(record->size && (address + record->size - 1) / header->page_size > last_used_page)
+            last_used_page = (address + record->size - 1) / header->page_size;
+    }
+    unsigned long occupancy[MAP_OCCUPANCY_BUCKETS] = {0}, pinned = 0;
+    for(uint64_t page = 0; page < page_count; ++page)
+    {
+        int bucket = pages[page] ? 1 + (int)((uint64_t)(pages[page] - 1) * (MAP_OCCUPANCY_BUCKETS - 1) / header->page_size) : 0;
+        occupancy[bucket]++;
+        pinned += !pages[page] && page < last_used_page;     // empty, but trimming cannot give it back
+    }
+    free(pages);
+
+    if(list)
+    {
+        printf("%12s %-9s %5s %12s  %s\n", "offset", "kind", "arena", "size", "site");
+        for(size_t i = 0; i < count; ++i)
+        {
+            const struct heap_map_record* record = &blocks[i].record;
+            printf("%12llu %-9s %5d %12llu", (unsigned long long)record->offset, record->kind <= map_debug_table ? map_kind_names[record->kind] : "?",
+                record->arena, (unsigned long long)record->size);
+            if(blocks[i].filename)
+                printf("  %s:%d", blocks[i].filename, record->fileline);
+            else if(record->kind == map_slab_page && record->fileline)
+                printf("  objects of %d bytes", record->fileline);
+            printf("\n");
+        }
+        printf("\n");
+    }
+
+    printf("footprint %llu bytes, %llu pages\n", (unsigned long long)footprint, (unsigned long long)page_count);
+    printf("used      %llu bytes in %lu blocks, %llu bytes in slab objects\n", (unsigned long long)used_bytes, kinds[map_used], (unsigned long long)slab_bytes);
+    printf("free      %llu bytes in %lu blocks, largest %llu, unused end of the heap %llu\n", (unsigned long long)free_bytes, kinds[map_free],
+        (unsigned long long)largest_free, (unsigned long long)tail);
+    printf("overhead  %llu bytes of headers and fences, %lu thread arenas, %lu slab chunks with %lu pages, %lu debug tables\n", (unsigned long long)overhead,
+        kinds[map_arena], kinds[map_slab_chunk], kinds[map_slab_page], kinds[map_debug_table]);
+    printf("external fragmentation %.3f (1 - largest free block / free bytes)\n", free_bytes ? 1.0 - (double)largest_free / (double)free_bytes : 0.0);
+    printf("last block %s, so trimming can give back %llu bytes\n", last && last->record.kind == map_free ? "free" : "used",
+        (unsigned long long)(tail + (last && last->record.kind == map_free ? last->record.size : 0)));
+    printf("pages by used bytes: empty %lu, up to 1/4 %lu, 1/2 %lu, 3/4 %lu, full %lu; %lu empty pages below the last used one\n",
+        occupancy[0], occupancy[1], occupancy[2], occupancy[3], occupancy[4], pinned);
+    printf("\n");
+    map_sites(blocks, count, shown);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = NULL;
+    int list = 0, shown = 10, usage = 0;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(!strcmp(argv[i], "-l"))
+            list = 1;
+        else if(!strcmp(argv[i], "-s") && i + 1 < argc)
+            shown = atoi(argv[++i]);
+        else if(!path && argv[i][0] != '-')
+            path = argv[i];
+        else
+            usage = 1;
+    }
+    if(usage || !path)
+    {
+        printf("usage: %s [-l] [-s sites] map_file\n", argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(path, "rb");
+    struct heap_map_header header;
+    if(!file || fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, MAP_MAGIC, sizeof(header.magic))
+        || header.record_size != sizeof(struct heap_map_record) || !header.page_size)
+    {
+        printf("%s is not a heap map\n", path);
+        if(file)
+            fclose(file);
+        return 1;
+    }
+    size_t count = 0, capacity = 4096;
+    struct map_block* blocks = malloc(capacity * sizeof(*blocks));
+    int status = 0;
+    while(blocks && fread(&blocks[count].record, sizeof(struct heap_map_record), 1, file) == 1)
+    {
+        struct map_block* block = &blocks[count];
+        block->filename = NULL;
+        if(block->record.filename_length)
+        {
+            block->filename = malloc(block->record.filename_length + 1u);
+            if(!block->filename || fread(block->filename, block->record.filename_length, 1, file) != 1)
+            {
+                free(block->filename);
+                status = -1;
+                break;
+            }
+            block->filename[block->record.filename_length] = '\0';
+        }
+        if(++count == capacity)
+        {
+            capacity *= 2;
+            struct map_block* bigger = realloc(blocks, capacity * sizeof(*blocks));
+            if(!bigger)
+            {
+                status = -1;
+                break;
+            }
+            blocks = bigger;
+        }
+    }
+    fclose(file);
+    if(!blocks || status)
+        printf("%s is truncated or too big\n", path);
+    else
+        status = map_analyse(&header, blocks, count, list, shown);
+
+    for(size_t i = 0; blocks && i < count; ++i)
+        free(blocks[i].filename);
+    free(blocks);
+    return status ? 1 : 0;
+}
@@ -0,0 +1,288 @@
+#include "heap.h"
+#include <stdlib.h>
+#include <time.h>
+
+// replays a trace written between heap_trace_start and heap_trace_stop against heap.c
+// usage: heap_replay [-f] [-r repeats] trace_file
+//   -f  turns thread caches, slabs and remote frees on
+//   -r  replays the trace this many times on a fresh heap (default 1)
+// the records are replayed in the recorded order on one thread, so every run does the same calls
+
+#define REPLAY_LATENCY_BUCKETS 40       // log2 of nanoseconds
+
+struct replay_slot{
+    uint64_t object;                    // address in the traced program, 0 marks an empty slot
+    void* ptr;                          // the block standing in for it here
+};
+
+struct replay_map{                      // open addressing, linear probing
+    struct replay_slot* slots;
+    size_t mask;
+    size_t count;
+};
+
+struct replay_op_stats{
+    unsigned long count;
+    unsigned long failed;
+    uint64_t nanoseconds;
+    unsigned long latency[REPLAY_LATENCY_BUCKETS];
+};
+
+const char* replay_op_names[] = {"malloc", "calloc", "realloc", "free", "memalign"};
+
+size_t replay_hash(uint64_t object, size_t mask)
+{
+    object ^= object >> 33;
+    object *= 0xff51afd7ed558ccdull;
+    object ^= object >> 33;
+    return (size_t)object & mask;
+}
+
+int replay_map_grow(struct replay_map* map)
+{
+    struct replay_map bigger = {calloc((map->mask + 1) * 2, sizeof(struct replay_slot)), map->mask * 2 + 1, map->count};
+    if(!bigger.slots)
+        return -1;
+    for(size_t i = 0; i <= map->mask; ++i)
+    {
+        if(!map->slots[i].object)
+            continue;
+        size_t slot = replay_hash(map->slots[i].object, bigger.mask);
+        while(bigger.slots[slot].object)
+            slot = (slot + 1) & bigger.mask;
+        bigger.slots[slot] = map->slots[i];
+    }
+    free(map->slots);
+    *map = bigger;
+    return 0;
+}
+
+int replay_map_put(struct replay_map* map, uint64_t object, void* ptr)     // replaces the block of an object that was never freed
+{
+    if((map->count + 1) * 2 > map->mask + 1 && replay_map_grow(map))
+        return -1;
+    size_t slot = replay_hash(object, map->mask);
+    while(map->slots[slot].object && map->slots[slot].object != object)
+        slot = (slot + 1) & map->mask;
+    if(!map->slots[slot].object)
+        map->count++;
+    map->slots[slot] = (struct replay_slot){object, ptr};
+    return 0;
+}
+
+void* replay_map_take(struct replay_map* map, uint64_t object)     // removes the object, NULL when it is unknown
+{
+    size_t slot = replay_hash(object, map->mask);
+    while(map->slots[slot].object != object)
+    {
+        if(!map->slots[slot].object)
+            return NULL;
+        slot = (slot + 1) & map->mask;
+    }
+    void* ptr = map->slots[slot].ptr;
+    for(size_t next = (slot + 1) & map->mask; map->slots[next].object; next = (next + 1) & map->mask)     // backward shift
+    {
+        size_t home = replay_hash(map->slots[next].object, map->mask);
+        if(((next - home) & map->mask) >= ((next - slot) & map->mask))
+        {
+            map->slots[slot] = map->slots[next];
+            slot = next;
+        }
+    }
+    map->slots[slot].object = 0;
+    map->count--;
+    return ptr;
+}
+
+uint64_t replay_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+void replay_latency(struct replay_op_stats* stats, uint64_t nanoseconds)
+{
+    int bucket = nanoseconds ? 64 - __builtin_clzll(nanoseconds) : 0;
+    stats->count++;
+    stats->nanoseconds += nanoseconds;
+    stats->latency[bucket < REPLAY_LATENCY_BUCKETS ? bucket : REPLAY_LATENCY_BUCKETS - 1]++;
+}
+
+uint64_t replay_percentile(const struct replay_op_stats* stats, double fraction)     // upper bound of the bucket holding it
+{
+    unsigned long wanted = (unsigned long)(stats->count * fraction), seen = 0;
+    for(int bucket = 0; bucket < REPLAY_LATENCY_BUCKETS; ++bucket)
+    {
+        seen += stats->latency[bucket];
+        if(seen > wanted)
+            return 1ull << bucket;
+    }
+    return 1ull << (REPLAY_LATENCY_BUCKETS - 1);
+}
+
+void* replay_record(const struct heap_trace_record* record, void* previous)
+{
+    size_t alignment = record->alignment_log2 ? (size_t)1 << record->alignment_log2 : 0;
+    switch(record->op)
+    {
+        case trace_malloc:
+            return heap_malloc(record->size);
+        case trace_calloc:
+            return heap_calloc(1, record->size);
+        case trace_memalign:
+            return heap_memalign(alignment, record->size);
+        case trace_realloc:
+            if(alignment == PAGE_SIZE)
+                return heap_realloc_aligned(previous, record->size);
+            if(alignment && record->size)     // no realloc keeps other alignments, the contents do not matter here
+            {
+                void* ptr = heap_memalign(alignment, record->size);
+                heap_free(ptr ? previous : NULL);
+                return ptr;
+            }
+            return heap_realloc(previous, record->size);
+        default:
+            heap_free(previous);
+            return NULL;
+    }
+}
+
+int replay_run(const struct heap_trace_record* records, size_t count, int fast, int last)
+{
+    struct heap_config config;
+    heap_get_default_config(&config);
+    config.validation = validation_off;     // the allocator is measured, not heap_validate
+    config.arenas = 1;
+    config.thread_cache = fast;
+    config.slabs = fast;
+    config.remote_frees = fast;
+    if(heap_setup_ex(&config))
+    {
+        printf("heap_setup_ex failed\n");
+        return -1;
+    }
+
+    struct replay_map map = {calloc(1024, sizeof(struct replay_slot)), 1023, 0};
+    struct replay_op_stats ops[trace_memalign + 1] = {0};
+    unsigned long unknown = 0, skipped = 0, live = 0, peak_live = 0;
+    uint64_t total = 0, traced = count ? records[count - 1].timestamp - records[0].timestamp : 0;
+    for(size_t i = 0; map.slots && i < count; ++i)
+    {
+        const struct heap_trace_record* record = &records[i];
+        if(record->op > trace_memalign || (record->op != trace_free && !record->object && record->size))
+        {
+            skipped++;     // failed while tracing, the traced program went on without the block
+            continue;
+        }
+        uint64_t object = record->op == trace_free ? record->object : record->op == trace_realloc ? record->previous : 0;
+        void* previous = NULL;
+        if(object)
+        {
+            previous = replay_map_take(&map, object);
+            if(!previous)
+            {
+                unknown++;     // allocated before the trace started
+                continue;
+            }
+            live--;
+        }
+
+        uint64_t start = replay_now();
+        void* ptr = replay_record(record, previous);
+        uint64_t nanoseconds = replay_now() - start;
+        total += nanoseconds;
+        replay_latency(&ops[record->op], nanoseconds);
+
+        if(record->op == trace_free)
+            continue;
+        if(!ptr && record->size)
+            ops[record->op].failed++;
+        if(ptr && replay_map_put(&map, record->object, ptr) == 0)
+            live++;
+        peak_live = live > peak_live ? live : peak_live;
+    }
+
+    heap_thread_cache_flush();
+    struct heap_stats stats;
+    heap_get_stats(&stats);
+    if(last)
+    {
+        printf("%-10s %10s %8s %10s %10s %10s %10s\n", "op", "count", "failed", "avg ns", "p50 ns", "p99 ns", "p99.9 ns");
+        for(int op = 0; op <= trace_memalign; ++op)
+        {
+            if(!ops[op].count)
+                continue;
+            printf("%-10s %10lu %8lu %10.0f %10llu %10llu %10llu\n", replay_op_names[op], ops[op].count, ops[op].failed,
+                (double)ops[op].nanoseconds / ops[op].count, (unsigned long long)replay_percentile(&ops[op], 0.5),
+                (unsigned long long)replay_percentile(&ops[op], 0.99), (unsigned long long)replay_percentile(&ops[op], 0.999));
+        }
+        printf("records %zu, unknown blocks %lu, skipped %lu, peak live %lu, traced %.3f s\n", count, unknown, skipped, peak_live, traced / 1e9);
+    }
+    printf("replay %.0f ops/s, in use %zu, footprint %zu, peak %zu, sbrk %lu, fragmentation %.3f, validate %d\n",
+        total ? (double)(count - unknown - skipped) * 1e9 / total : 0.0, stats.in_use, stats.footprint, stats.peak_footprint,
+        stats.sbrk_calls, stats.fragmentation, heap_validate());
+    free(map.slots);
+    heap_clean();
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = NULL;
+    int fast = 0, repeats = 1, usage = 0;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(!strcmp(argv[i], "-f"))
+            fast = 1;
+        else if(!strcmp(argv[i], "-r") && i + 1 < argc)
+            repeats = atoi(argv[++i]);
+        else if(!path && argv[i][0] != '-')
+            path = argv[i];
+        else
+            usage = 1;
+    }
+    if(usage || !path || repeats < 1)
+    {
+        printf("usage: %s [-f] [-r repeats] trace_file\n", argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(path, "rb");
+    struct heap_trace_header header;
+    if(!file || fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic))
+        || header.record_size != sizeof(struct heap_trace_record))
+    {
+        printf("%s is not a heap trace\n", path);
+        if(file)
+            fclose(file);
+        return 1;
+    }
+    size_t count = 0, capacity = 4096;
+    struct heap_trace_record* records = malloc(capacity * sizeof(*records));
+    while(records && fread(&records[count], sizeof(*records), 1, file) == 1)
+    {
+        if(++count == capacity)
+        {
+            capacity *= 2;
+            struct heap_trace_record* bigger = realloc(records, capacity * sizeof(*records));
+            if(!bigger)
+                free(records);
+            records = bigger;
+        }
+    }
+    fclose(file);
+    if(!records)
+    {
+        printf("out of memory reading %s\n", path);
+        return 1;
+    }
+
+    for(int run = 0; run < repeats; ++run)
+    {
+        if(replay_run(records, count, fast, run == repeats - 1))
+            return 1;
+    }
+    free(records);
+    return 0;
+}
@@ -445,6 +445,87 @@
             return a;
         }
 
+            void *heap_batch_test_thread(void *a)
+            {
+               void *ptr[64];
+
+               for (int i = 0; i < 200; ++i)
+               {
+                 size_t size = rand() % 1500 + 300;
+                 size_t count = heap_malloc_batch(size, 32, ptr);
+                 test_error(count == 32, "Funkcja heap_malloc_batch() powinna zwrócić wartość 32, a zwróciła %zu", count);
+
+                 for (int j = 32; j < 64; ++j)
+                 {
+                   ptr[j] = heap_malloc(rand() % 200 + 1);
+                   test_error(ptr[j] != NULL, "Funkcja heap_malloc() powinna zwrócić adres przydzielonej pamięci");
+                 }
+
+                 for (int j = 0; j < 64; ++j)
+                 {
+                   int k = rand() % 64;
+                   void *temp = ptr[j];
+                   ptr[j] = ptr[k];
+                   ptr[k] = temp;
+                 }
+
+                 heap_free_batch(ptr, 64);
+               }
+
+               return a;
+            }
+
+            void *heap_slab_grow_test_thread(void *a)
+            {
+               void *ptr[4000];
+
+               for (int j = 0; j < 4000; ++j)
+               {
+                 ptr[j] = heap_malloc(rand() % 200 + 1);
+                 test_error(ptr[j] != NULL, "Funkcja heap_malloc() powinna zwrócić adres przydzielonej pamięci");
+               }
+
+               for (int j = 0; j < 4000; ++j)
+                 heap_free(ptr[j]);
+
+               return a;
+            }
+
+            void *remote_free_test_slots[16][100];
+            pthread_mutex_t remote_free_test_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+            void *heap_remote_free_test_thread(void *a)
+            {
+               void *ptr[100];
+
+               for (int i = 0; i < 100; ++i)
+               {
+                 for (int j = 0; j < 100; ++j)
+                 {
+                   size_t size = rand() % 4 ? rand() % 200 + 1 : rand() % 3000 + 1;
+                   ptr[j] = heap_malloc(size);
+                   test_error(ptr[j] != NULL, "Funkcja heap_malloc() powinna zwrócić adres przydzielonej pamięci");
+                   memset(ptr[j], j, size);
+                 }
+
+                 // bloki trafiają do innego wątku, a wątek zwalnia te, które przydzielił ktoś inny
+                 int k = rand() % 16;
+                 pthread_mutex_lock(&remote_free_test_mutex);
+                 for (int j = 0; j < 100; ++j)
+                 {
+                   void *temp = remote_free_test_slots[k][j];
+                   remote_free_test_slots[k][j] = ptr[j];
+                   ptr[j] = temp;
+                 }
+                 pthread_mutex_unlock(&remote_free_test_mutex);
+
+                 for (int j = 0; j < 100; ++j)
+                   heap_free(ptr[j]);
+               }
+
+               return a;
+            }
+
         
 
 
@@ -9340,6 +9421,380 @@ void UTEST139(void)
 
 
 
+//
+//  Test 140: Sprawdzanie poprawności działania funkcji heap_malloc_batch i heap_free_batch w przypadku wywoływania ich w różnych wątkach
+//
+void UTEST140(void)
+{
+    // informacje o teście
+    test_start(140, "Sprawdzanie poprawności działania funkcji heap_malloc_batch i heap_free_batch w przypadku wywoływania ich w różnych wątkach", __LINE__);
+
+    // uwarunkowanie zasobów - pamięci, itd...
+    test_file_write_limit_setup(33554432);
+    rldebug_reset_limits();
+    
+    //
+    // -----------
+    //
+    
+                 srand (time(NULL));
+
+                 struct heap_config config;
+                 heap_get_default_config(&config);
+                 config.slabs = 1;
+
+                 int status = heap_setup_ex(&config);
+                 test_error(status == 0, "Funkcja heap_setup_ex() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 pthread_t threads[8];
+
+                 for (int i = 0; i < 8; ++i)
+                     pthread_create(threads + i, NULL, i % 2 ? heap_slab_grow_test_thread : heap_batch_test_thread, NULL);
+
+
+                 for (int i = 0; i < 8; ++i)
+                     pthread_join(threads[i], NULL);
+
+                 status = heap_validate();
+                 test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 status = custom_sbrk_check_fences_integrity();
+                 test_error(status == 0, "Funkcja custom_sbrk_check_fences_integrity() powinna zwrócić wartość 0, a zwróciła na %d. Oznacza to, że alokator nadpisał pamięć, która nie została przydzielona przez system", status);
+
+                 heap_clean();
+
+                 heap_get_default_config(&config);
+                 heap_set_slabs(config.slabs);
+
+                 uint64_t reserved_memory = custom_sbrk_get_reserved_memory();
+                 test_error(reserved_memory == 0, "Funkcja custom_sbrk_get_reserved_memory() powinna zwrócić wartość 0, a zwróciła na %llu. Po wywołaniu funkcji heap_clean cała pamięć zarezerwowana przez alokator powinna być zwrócona do systemu", reserved_memory);
+
+              
+    //
+    // -----------
+    //
+
+    // przywrócenie podstawowych parametów przydzielania zasobów (jeśli to tylko możliwe)
+    rldebug_reset_limits();
+    test_file_write_limit_restore();
+    
+    test_ok();
+}
+
+
+
+
+//
+//  Test 141: Sprawdzanie poprawności działania funkcji heap_memalign i heap_aligned_alloc - test sprawdza wyrównanie bloków, ich realokację oraz ponowne wykorzystanie wolnego miejsca przed wyrównanym blokiem
+//
+void UTEST141(void)
+{
+    // informacje o teście
+    test_start(141, "Sprawdzanie poprawności działania funkcji heap_memalign i heap_aligned_alloc - test sprawdza wyrównanie bloków, ich realokację oraz ponowne wykorzystanie wolnego miejsca przed wyrównanym blokiem", __LINE__);
+
+    // uwarunkowanie zasobów - pamięci, itd...
+    test_file_write_limit_setup(33554432);
+    rldebug_reset_limits();
+    
+    //
+    // -----------
+    //
+    
+                 srand (time(NULL));
+
+                 int status = heap_setup();
+                 test_error(status == 0, "Funkcja heap_setup() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 void *ptr = heap_memalign(24, 100);
+                 test_error(ptr == NULL, "Funkcja heap_memalign() powinna zwrócić wartość NULL dla wyrównania, które nie jest potęgą dwójki");
+
+                 ptr = heap_aligned_alloc(0, 100);
+                 test_error(ptr == NULL, "Funkcja heap_aligned_alloc() powinna zwrócić wartość NULL dla wyrównania równego 0");
+
+                 void *ptrs[18];
+                 size_t sizes[18];
+
+                 for (int i = 0; i < 18; ++i)
+                 {
+                     size_t alignment = (size_t)1 << (i % 9 + 4);
+                     sizes[i] = rand() % 500 + 1;
+                     ptrs[i] = i < 9 ? heap_memalign(alignment, sizes[i]) : heap_aligned_alloc(alignment, sizes[i]);
+                     test_error(ptrs[i] != NULL, "Funkcja %s() powinna zwrócić adres przydzielonej pamięci", i < 9 ? "heap_memalign" : "heap_aligned_alloc");
+                     test_error(((intptr_t)ptrs[i] & (intptr_t)(alignment - 1)) == 0, "Adres zwrócony przez funkcję %s() powinien być wyrównany do %zu bajtów", i < 9 ? "heap_memalign" : "heap_aligned_alloc", alignment);
+                     test_error(get_pointer_type(ptrs[i]) == pointer_valid, "Funkcja get_pointer_type() powinna zwrócić wartość pointer_valid dla adresu zwróconego przez funkcję %s()", i < 9 ? "heap_memalign" : "heap_aligned_alloc");
+                     memset(ptrs[i], i + 1, sizes[i]);
+
+                     status = heap_validate();
+                     test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+                 }
+
+                 for (int i = 0; i < 18; i += 2)
+                 {
+                     void *temp = heap_realloc(ptrs[i], sizes[i] * 4);
+                     test_error(temp != NULL, "Funkcja heap_realloc() powinna zwrócić adres przydzielonej pamięci");
+
+                     for (size_t j = 0; j < sizes[i]; ++j)
+                         test_error(((unsigned char *)temp)[j] == i + 1, "Funkcja heap_realloc() powinna zachować zawartość realokowanego bloku");
+
+                     ptrs[i] = temp;
+                     memset(ptrs[i], i + 1, sizes[i] * 4);
+
+                     status = heap_validate();
+                     test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+                 }
+
+                 for (int i = 0; i < 18; ++i)
+                     heap_free(ptrs[i]);
+
+                 status = heap_validate();
+                 test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 size_t largest = heap_get_largest_used_block_size();
+                 test_error(largest == 0, "Funkcja heap_get_largest_used_block_size() powinna zwrócić wartość 0, a zwróciła na %zu", largest);
+
+                 heap_clean();
+
+                 status = heap_setup();
+                 test_error(status == 0, "Funkcja heap_setup() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 void *aligned = heap_memalign(PAGE_SIZE, 100);
+                 test_error(aligned != NULL, "Funkcja heap_memalign() powinna zwrócić adres przydzielonej pamięci");
+                 test_error(((intptr_t)aligned & (intptr_t)(PAGE_SIZE - 1)) == 0, "Adres zwrócony przez funkcję heap_memalign() powinien być wyrównany do %d bajtów", PAGE_SIZE);
+
+                 ptr = heap_malloc(100);
+                 test_error(ptr != NULL, "Funkcja heap_malloc() powinna zwrócić adres przydzielonej pamięci");
+                 test_error((intptr_t)ptr < (intptr_t)aligned, "Funkcja heap_malloc() powinna przydzielić pamięć w wolnym miejscu przed blokiem wyrównanym przez funkcję heap_memalign()");
+
+                 status = heap_validate();
+                 test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 heap_free(aligned);
+                 heap_free(ptr);
+
+                 status = heap_validate();
+                 test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 status = custom_sbrk_check_fences_integrity();
+                 test_error(status == 0, "Funkcja custom_sbrk_check_fences_integrity() powinna zwrócić wartość 0, a zwróciła na %d. Oznacza to, że alokator nadpisał pamięć, która nie została przydzielona przez system", status);
+
+                 heap_clean();
+
+                 uint64_t reserved_memory = custom_sbrk_get_reserved_memory();
+                 test_error(reserved_memory == 0, "Funkcja custom_sbrk_get_reserved_memory() powinna zwrócić wartość 0, a zwróciła na %llu. Po wywołaniu funkcji heap_clean cała pamięć zarezerwowana przez alokator powinna być zwrócona do systemu", reserved_memory);
+
+              
+    //
+    // -----------
+    //
+
+    // przywrócenie podstawowych parametów przydzielania zasobów (jeśli to tylko możliwe)
+    rldebug_reset_limits();
+    test_file_write_limit_restore();
+    
+    test_ok();
+}
+
+
+
+
+//
+//  Test 142: Sprawdzanie poprawności działania funkcji heap_trim oraz automatycznego zwalniania końca sterty przez funkcję heap_free
+//
+void UTEST142(void)
+{
+    // informacje o teście
+    test_start(142, "Sprawdzanie poprawności działania funkcji heap_trim oraz automatycznego zwalniania końca sterty przez funkcję heap_free", __LINE__);
+
+    // uwarunkowanie zasobów - pamięci, itd...
+    test_file_write_limit_setup(33554432);
+    rldebug_reset_limits();
+    
+    //
+    // -----------
+    //
+    
+                 struct heap_config config;
+                 heap_get_default_config(&config);
+
+                 int status = heap_setup_ex(&config);
+                 test_error(status == 0, "Funkcja heap_setup_ex() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 void *ptr = heap_malloc(100);
+                 test_error(ptr != NULL, "Funkcja heap_malloc() powinna zwrócić adres przydzielonej pamięci");
+
+                 void *big = heap_malloc(4 * 1024 * 1024);
+                 test_error(big != NULL, "Funkcja heap_malloc() powinna zwrócić adres przydzielonej pamięci");
+
+                 uint64_t grown = custom_sbrk_get_reserved_memory();
+
+                 heap_free(big);
+
+                 uint64_t auto_trimmed = custom_sbrk_get_reserved_memory();
+                 test_error(auto_trimmed < grown, "Funkcja heap_free() powinna zwrócić do systemu wolny koniec sterty, jednak ilość zarezerwowanej pamięci nie zmieniła się (%llu bajtów)", auto_trimmed);
+
+                 status = heap_validate();
+                 test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 status = heap_trim(0);
+                 test_error(status == 1, "Funkcja heap_trim() powinna zwrócić wartość 1, a zwróciła na %d", status);
+
+                 uint64_t trimmed = custom_sbrk_get_reserved_memory();
+                 test_error(trimmed < auto_trimmed, "Funkcja heap_trim() powinna zwrócić do systemu zapas pozostawiony przez funkcję heap_free, jednak ilość zarezerwowanej pamięci nie zmieniła się (%llu bajtów)", trimmed);
+
+                 status = heap_trim(0);
+                 test_error(status == 0, "Funkcja heap_trim() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 status = heap_validate();
+                 test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 heap_free(ptr);
+                 heap_trim(0);
+
+                 uint64_t reserved_memory = custom_sbrk_get_reserved_memory();
+                 test_error(reserved_memory == PAGE_SIZE, "Funkcja custom_sbrk_get_reserved_memory() powinna zwrócić wartość %d, a zwróciła na %llu. Po zwolnieniu wszystkich bloków funkcja heap_trim powinna pozostawić jedną stronę", PAGE_SIZE, reserved_memory);
+
+                 status = heap_validate();
+                 test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 ptr = heap_malloc(1000);
+                 test_error(ptr != NULL, "Funkcja heap_malloc() powinna zwrócić adres przydzielonej pamięci");
+                 memset(ptr, 0x5A, 1000);
+
+                 size_t largest = heap_get_largest_used_block_size();
+                 test_error(largest == 1000, "Funkcja heap_get_largest_used_block_size() powinna zwrócić wartość 1000, a zwróciła na %zu", largest);
+
+                 status = heap_validate();
+                 test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 heap_set_trim(0, config.trim_pad);
+
+                 big = heap_malloc(4 * 1024 * 1024);
+                 test_error(big != NULL, "Funkcja heap_malloc() powinna zwrócić adres przydzielonej pamięci");
+
+                 grown = custom_sbrk_get_reserved_memory();
+
+                 heap_free(big);
+
+                 reserved_memory = custom_sbrk_get_reserved_memory();
+                 test_error(reserved_memory == grown, "Funkcja heap_free() nie powinna zwracać pamięci do systemu po wyłączeniu automatycznego zwalniania końca sterty, a ilość zarezerwowanej pamięci zmieniła się z %llu na %llu bajtów", grown, reserved_memory);
+
+                 status = heap_trim(0);
+                 test_error(status == 1, "Funkcja heap_trim() powinna zwrócić wartość 1, a zwróciła na %d", status);
+
+                 reserved_memory = custom_sbrk_get_reserved_memory();
+                 test_error(reserved_memory < grown, "Funkcja heap_trim() powinna zwrócić do systemu wolny koniec sterty, jednak ilość zarezerwowanej pamięci nie zmieniła się (%llu bajtów)", reserved_memory);
+
+                 heap_free(ptr);
+
+                 status = heap_validate();
+                 test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 status = custom_sbrk_check_fences_integrity();
+                 test_error(status == 0, "Funkcja custom_sbrk_check_fences_integrity() powinna zwrócić wartość 0, a zwróciła na %d. Oznacza to, że alokator nadpisał pamięć, która nie została przydzielona przez system", status);
+
+                 heap_clean();
+
+                 heap_set_trim(config.trim_threshold, config.trim_pad);
+
+                 reserved_memory = custom_sbrk_get_reserved_memory();
+                 test_error(reserved_memory == 0, "Funkcja custom_sbrk_get_reserved_memory() powinna zwrócić wartość 0, a zwróciła na %llu. Po wywołaniu funkcji heap_clean cała pamięć zarezerwowana przez alokator powinna być zwrócona do systemu", reserved_memory);
+
+              
+    //
+    // -----------
+    //
+
+    // przywrócenie podstawowych parametów przydzielania zasobów (jeśli to tylko możliwe)
+    rldebug_reset_limits();
+    test_file_write_limit_restore();
+    
+    test_ok();
+}
+
+
+
+
+//
+//  Test 143: Sprawdzanie poprawności działania funkcji malloc i free w przypadku zwalniania bloków w innych wątkach niż te, które je przydzieliły, przy włączonych pamięciach podręcznych wątków, arenach i kolejkach zdalnych zwolnień
+//
+void UTEST143(void)
+{
+    // informacje o teście
+    test_start(143, "Sprawdzanie poprawności działania funkcji malloc i free w przypadku zwalniania bloków w innych wątkach niż te, które je przydzieliły, przy włączonych pamięciach podręcznych wątków, arenach i kolejkach zdalnych zwolnień", __LINE__);
+
+    // uwarunkowanie zasobów - pamięci, itd...
+    test_file_write_limit_setup(33554432);
+    rldebug_reset_limits();
+    
+    //
+    // -----------
+    //
+    
+                 srand (time(NULL));
+
+                 struct heap_config config;
+                 heap_get_default_config(&config);
+                 config.thread_cache = 1;
+                 config.arenas = 4;
+                 config.remote_frees = 1;
+
+                 int status = heap_setup_ex(&config);
+                 test_error(status == 0, "Funkcja heap_setup_ex() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 memset(remote_free_test_slots, 0, sizeof(remote_free_test_slots));
+
+                 pthread_t threads[16];
+
+                 for (int i = 0; i < 16; ++i)
+                     pthread_create(threads + i, NULL, heap_remote_free_test_thread, NULL);
+
+
+                 for (int i = 0; i < 16; ++i)
+                     pthread_join(threads[i], NULL);
+
+                 status = heap_validate();
+                 test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 for (int i = 0; i < 16; ++i)
+                     for (int j = 0; j < 100; ++j)
+                         heap_free(remote_free_test_slots[i][j]);
+
+                 heap_thread_cache_flush();
+
+                 status = heap_validate();
+                 test_error(status == 0, "Funkcja heap_validate() powinna zwrócić wartość 0, a zwróciła na %d", status);
+
+                 size_t largest = heap_get_largest_used_block_size();
+                 test_error(largest == 0, "Funkcja heap_get_largest_used_block_size() powinna zwrócić wartość 0, a zwróciła na %zu", largest);
+
+                 status = custom_sbrk_check_fences_integrity();
+                 test_error(status == 0, "Funkcja custom_sbrk_check_fences_integrity() powinna zwrócić wartość 0, a zwróciła na %d. Oznacza to, że alokator nadpisał pamięć, która nie została przydzielona przez system", status);
+
+                 heap_clean();
+
+                 heap_get_default_config(&config);
+                 heap_set_thread_cache(config.thread_cache);
+                 heap_set_arenas(config.arenas);
+                 heap_set_remote_frees(config.remote_frees);
+
+                 uint64_t reserved_memory = custom_sbrk_get_reserved_memory();
+                 test_error(reserved_memory == 0, "Funkcja custom_sbrk_get_reserved_memory() powinna zwrócić wartość 0, a zwróciła na %llu. Po wywołaniu funkcji heap_clean cała pamięć zarezerwowana przez alokator powinna być zwrócona do systemu", reserved_memory);
+
+              
+    //
+    // -----------
+    //
+
+    // przywrócenie podstawowych parametów przydzielania zasobów (jeśli to tylko możliwe)
+    rldebug_reset_limits();
+    test_file_write_limit_restore();
+    
+    test_ok();
+}
+
+
+
+
 enum run_mode_t { rm_normal_with_rld = 0, rm_unit_test = 1, rm_main_test = 2 };
 
 int __wrap_main(volatile int _argc, char** _argv, char** _envp)
@@ -9541,6 +9996,10 @@ int __wrap_main(volatile int _argc, char** _argv, char** _envp)
             UTEST137, // Sprawdzanie poprawności działania funkcji malloc i free w przypadku wywoływania ich w różnych wątkach
             UTEST138, // Sprawdzanie poprawności działania funkcji *_aligned i free w przypadku wywoływania ich w różnych wątkach
             UTEST139, // Sprawdzanie poprawności działania wszystkich funkcji w przypadku wywoływania ich w różnych wątkach
+            UTEST140, // Sprawdzanie poprawności działania funkcji heap_malloc_batch i heap_free_batch w przypadku wywoływania ich w różnych wątkach
+            UTEST141, // Sprawdzanie poprawności działania funkcji heap_memalign i heap_aligned_alloc - test sprawdza wyrównanie bloków, ich realokację oraz ponowne wykorzystanie wolnego miejsca przed wyrównanym blokiem
+            UTEST142, // Sprawdzanie poprawności działania funkcji heap_trim oraz automatycznego zwalniania końca sterty przez funkcję heap_free
+            UTEST143, // Sprawdzanie poprawności działania funkcji malloc i free w przypadku zwalniania bloków w innych wątkach niż te, które je przydzieliły, przy włączonych pamięciach podręcznych wątków, arenach i kolejkach zdalnych zwolnień
             NULL
         };
 
@@ -9563,7 +10022,7 @@ int __wrap_main(volatile int _argc, char** _argv, char** _envp)
         // poinformuj serwer Mrówka o wyniku testu - podsumowanie
         test_title("Podsumowanie");
         if (selected_test == -1)
-            test_summary(139); // wszystkie testy muszą zakończyć się sukcesem
+            test_summary(143); // wszystkie testy muszą zakończyć się sukcesem
         else
             test_summary(1); // tylko jeden (selected_test) test musi zakończyć się  sukcesem
         return EXIT_SUCCESS;